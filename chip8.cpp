@@ -1,6 +1,20 @@
 //  A simple CHIP-8 emulator written by Kevin K. Biju
 //  Usage: simply pass the ROM as the LAST command line argument, must be of size 0x800 or less according with the CHIP-8 specification.
 //  Requires SDL2 to be installed. Enjoy!
+//  Headless: pass --headless [--cycles N | --frames N] [--input FILE] [--seed N] [--dump-pbm FILE] before the ROM to run unthrottled
+//  without a window. Building with -DHEADLESS_BUILD=1 drops the SDL2 dependency entirely.
+//  --speed X runs at X times the real CPU_FREQUENCY, 0 is unthrottled. Timers tick on emulated frames so runs are reproducible at any speed.
+//  Frames run 16 or 17 instructions so that every second of them adds up to exactly CPU_FREQUENCY.
+//  Batch: --batch [--threads N] JOBS runs every "ROM FRAMES SEED [INPUT]" line of JOBS headless on a work-stealing thread pool.
+//  Save states: --load-state FILE restores a machine before running, --save-state FILE writes it out after a headless run.
+//  In the window F5 saves to that file [ROM.state by default], F9 loads it back and holding Backspace rewinds frame by frame.
+//  Traces: --record FILE logs the seed and the per-frame key states of a session, --replay FILE feeds them back in [ignoring the
+//  keyboard] so the same trace always ends on the same framebuffer. --input takes the same format, a "seed N" line is optional.
+//  A trace only holds key states, so F9 state loads and rewinding are disabled while recording or replaying and --load-state
+//  is refused with either. Recording ends with an "end N" line, replays and headless runs stop after that many frames.
+//  In the window the CPU runs on its own thread, one frame's worth of instructions per input sample, while the main thread
+//  polls SDL and presents at the display's refresh rate.
+//  Profiling: build with -DPROFILER_BUILD=1, stats are written as JSON to --profile FILE on exit or when F1 is pressed.
 
 #include    <cstdlib>
 #include    <climits>
@@ -8,12 +22,30 @@
 
 #include    <iostream>
 #include    <fstream>
-#include    <stack>
 #include    <random>
 #include    <chrono>
 #include    <thread>
+#include    <vector>
+#include    <sstream>
+#include    <cstring>
+#include    <string>
+#include    <deque>
+#include    <mutex>
+#include    <algorithm>
+#include    <type_traits>
+#include    <atomic>
 
+#ifndef     HEADLESS_BUILD
+#define     HEADLESS_BUILD          0
+#endif
+
+#ifndef     PROFILER_BUILD
+#define     PROFILER_BUILD          0
+#endif
+
+#if         !HEADLESS_BUILD
 #include    <SDL2/SDL.h>
+#endif
 
 typedef     uint8_t                 u8;
 typedef     uint16_t                u16;
@@ -27,14 +59,47 @@ typedef     uint16_t                u16;
 #define     SCREEN_HEIGHT           32
 #define     SCALING_FACTOR          16
 #define     SCALING_MODE            "linear"
+#define     PIXEL_ON_COLOUR         0xFFFFFFFF
+#define     PIXEL_OFF_COLOUR        0xFF000000
 #define     MAX_RECURSION_DEPTH     16  
 #define     CPU_FREQUENCY           1000
-#define     INST_PER_CLOCK          1
 #define     CLIPPING_GRAPHICS       1
+#define     FRAME_RATE              60
+/*  the first instruction of a frame, CPU_FREQUENCY is not a multiple of FRAME_RATE so the remainder carries across frames */
+#define     FRAME_START_CYCLE(frame)    ((uint64_t)(frame) * CPU_FREQUENCY / FRAME_RATE)
+#define     HEADLESS_DEFAULT_FRAMES 600
+#define     NO_KEY_WAIT             0xFF
+#define     MAX_FRAME_LAG           4
+#define     FALLBACK_REFRESH_RATE   60
+#define     REWIND_SECONDS          300
+#define     REWIND_KEYFRAME_INTERVAL    60
+#define     STATE_FILE_MAGIC        "CHIP8ST1"
+#define     PROFILE_DEFAULT_PATH    "chip8_profile.json"
+
+#if         SCREEN_WIDTH != 64
+#error      "Framebuffer rows are packed into a uint64_t, SCREEN_WIDTH must be 64."
+#endif
 
 #define     INIT_SDL_ERROR          "SDL2 initialization failed. Error encountered was: " << SDL_GetError() << "\n"
 #define     INVALID_OPCODE_ERROR    "Invalid opcode encountered: " << std::hex << HEX0 << std::hex << HEX1 << " " << std::hex << HEX2 << std::hex << HEX3 << "\n"
 #define     STACK_OVERFLOW_ERROR    "Call stack overflow, verify program correctness?" << "\n"
+#define     STACK_UNDERFLOW_ERROR   "Return with an empty call stack, verify program correctness?" << "\n"
+#define     MEMORY_BOUNDS_ERROR     "Memory access out of bounds at " << std::hex << address << ", verify program correctness?" << "\n"
+#define     USAGE_ERROR             "Usage: " << argv[0] << " [--headless] [--speed X] [--cycles N | --frames N] [--input FILE] [--seed N] [--dump-pbm FILE]" \
+                                    << " [--load-state FILE] [--save-state FILE] [--profile FILE] [--record FILE | --replay FILE] ROM" << "\n" \
+                                    << "       " << argv[0] << " --batch [--threads N] JOBS" << "\n"
+#define     ROM_LOAD_ERROR          "Could not load ROM, missing or larger than 0xE00 bytes: " << path << "\n"
+#define     BATCH_LOAD_ERROR        "Could not parse batch job file: " << path << "\n"
+#define     BATCH_INPUT_ERROR       "Could not read input script: " << input_path << "\n"
+#define     STATE_LOAD_ERROR        "Could not load save state: " << run_options.load_state_path << "\n"
+#define     STATE_SAVE_ERROR        "Could not write save state: " << run_options.save_state_path << "\n"
+#define     PROFILE_WRITE_ERROR     "Could not write profile to: " << run_options.profile_path << "\n"
+#define     HEADLESS_BUILD_ERROR    "Built with HEADLESS_BUILD, pass --headless or rebuild with SDL2." << "\n"
+#define     INPUT_SCRIPT_ERROR      "Could not read input script: " << run_options.input_path << "\n"
+#define     TRACE_RECORD_ERROR      "Could not open input trace for recording: " << run_options.record_path << "\n"
+#define     PBM_WRITE_ERROR         "Could not write framebuffer to: " << run_options.pbm_path << "\n"
+#define     TRACE_LOCKED_ERROR      "State loads and rewinding are disabled while recording or replaying a trace." << "\n"
+#define     TRACE_STATE_ERROR       "--load-state cannot be combined with --record or --replay, traces start from a fresh machine." << "\n"
 
 #define     BIT_CUT(input, cut, count)  (((input) >> (cut)) & ((1 << (count)) - 1))
 #define     CMP_HEX(location, val)      (instruction_hex[location ## u] == 0x ## val)
@@ -50,22 +115,44 @@ typedef     uint16_t                u16;
 #define     _NN                     BIT_CUT(instruction, 0, 8)
 #define     _NNN                    BIT_CUT(instruction, 0, 12)
 
+/*  stops the machine with an error instead of exiting, so a bad ROM in a batch only fails its own job */
+#define     MACHINE_FAULT(message)  { std::ostringstream fault_stream; \
+                                    fault_stream << message; \
+                                    fault = fault_stream.str(); \
+                                    return; }
+
+/*  every span of memory an instruction touches is checked first, PC and I can both be pushed past the end */
+#define     MEMORY_CHECK(start, span)   { uint32_t address = (start); \
+                                    if(address + (span) > sizeof(memory)) { \
+                                        MACHINE_FAULT(MEMORY_BOUNDS_ERROR); \
+                                    } }
+
 #define     SDL_KEYDOWN(key)        case SDLK_ ## key: \
-                                    keyboard_press[0x ## key] = true; \
-                                    last_key_pressed = 0x ## key; \
+                                    host_input.keys |= (1 << 0x ## key); \
+                                    host_input.pressed |= (1 << 0x ## key); \
                                     break
 #define     SDL_KEYUP(key)          case SDLK_ ## key: \
-                                    keyboard_press[0x ## key] = false; \
+                                    host_input.keys &= (u16)~(1 << 0x ## key); \
                                     break
 
+/*  one uint64_t per row, the leftmost pixel is the MSB */
+#define     SCREEN_PIXEL(buffer, x, y)  BIT_CUT((buffer)[y], SCREEN_WIDTH - 1 - (x), 1)
+
+/*  compiled out entirely unless PROFILER_BUILD is set */
+#if PROFILER_BUILD
+#define     PROFILE_TIMED(timer, call)  { auto profile_start = std::chrono::steady_clock::now(); \
+                                    call; \
+                                    profile.timer.calls++; \
+                                    profile.timer.ticks += (std::chrono::steady_clock::now() - profile_start).count(); }
+#else
+#define     PROFILE_TIMED(timer, call)  call
+#endif
+
 #define     vX                      chip8_cpu_registers.v[_X]
 #define     vY                      chip8_cpu_registers.v[_Y]
 #define     vF                      chip8_cpu_registers.v[0xF]
 
 static std::random_device                   hrng;
-static std::mt19937                         engine;
-static std::uniform_int_distribution<u8>    generator(0x00, 0xFF);
-static std::stack<u16>                      call_stack;
 
 struct  chip8_cpu_registers_struct
 {
@@ -76,41 +163,254 @@ struct  chip8_cpu_registers_struct
 
     u8          delay_timer = 0x00;
     u8          sound_timer = 0x00;
-}       chip8_cpu_registers;
-
-u8      memory[0x1000] = {  0xF0, 0x90, 0x90, 0x90, 0xF0,   //  0
-                            0x20, 0x60, 0x20, 0x20, 0x70,   //  1
-                            0xF0, 0x10, 0xF0, 0x80, 0xF0,   //  2
-                            0xF0, 0x10, 0xF0, 0x10, 0xF0,   //  3
-                            0x90, 0x90, 0xF0, 0x10, 0x10,   //  4
-                            0xF0, 0x80, 0xF0, 0x10, 0xF0,   //  5
-                            0xF0, 0x80, 0xF0, 0x90, 0xF0,   //  6
-                            0xF0, 0x10, 0x20, 0x40, 0x40,   //  7
-                            0xF0, 0x90, 0xF0, 0x90, 0xF0,   //  8
-                            0xF0, 0x90, 0xF0, 0x10, 0xF0,   //  9
-                            0xF0, 0x90, 0xF0, 0x90, 0x90,   //  A
-                            0xE0, 0x90, 0xE0, 0x90, 0xE0,   //  B
-                            0xF0, 0x80, 0x80, 0x80, 0xF0,   //  C
-                            0xE0, 0x90, 0x90, 0x90, 0xE0,   //  D
-                            0xF0, 0x80, 0xF0, 0x80, 0xF0,   //  E
-                            0xF0, 0x80, 0xF0, 0x80, 0x80    //  F   
-                        };
-bool    keyboard_press[16] = { };
-u8      last_key_pressed = 0xFF;
-u8      screen_buffer[SCREEN_WIDTH][SCREEN_HEIGHT] = { };
+};
+
+/*  the complete machine state, flat so that it can be copied, XORed against another state and written out as bytes */
+struct  chip8_state_struct
+{
+    chip8_cpu_registers_struct  chip8_cpu_registers;
+    u8                          memory[0x1000];
+    uint64_t                    screen_buffer[SCREEN_HEIGHT];
+    u16                         call_stack[MAX_RECURSION_DEPTH + 1];
+    u8                          call_stack_depth;
+    bool                        keyboard_press[16];
+    u8                          key_wait_register;
+    std::minstd_rand            engine;
+};
+
+static_assert(std::is_trivially_copyable<chip8_state_struct>::value, "Save states are handled as raw bytes.");
+
+#if PROFILER_BUILD
+/*  the timers are kept by the main thread while F1 dumps from the emulation thread, so they are atomic */
+struct  profile_timer_struct {
+    std::atomic<uint64_t>                       calls{0};
+    std::atomic<std::chrono::steady_clock::rep> ticks{0};
+};
+
+/*  execution counts are kept per full instruction word and only bucketed into opcode classes when dumped */
+struct  chip8_profile_struct {
+    std::chrono::steady_clock::time_point       start;
+    uint64_t                                    frames = 0;
+    uint64_t                                    halted_cycles = 0;
+    uint64_t                                    instruction_counts[0x10000] = { };
+    uint64_t                                    pc_counts[0x1000] = { };
+    profile_timer_struct                        event_listener;
+    profile_timer_struct                        screen_render;
+}       profile;
+
+/*  mirrors the order of the decoder in instruction_parse_and_execute() */
+struct  opcode_class_struct {
+    u16                 mask;
+    u16                 value;
+    const char*         name;
+}       opcode_classes[] = {
+    { 0xFFFF, 0x00E0, "00E0" }, { 0xFFFF, 0x00EE, "00EE" }, { 0xF000, 0x1000, "1NNN" }, { 0xF000, 0x2000, "2NNN" },
+    { 0xF000, 0x3000, "3XNN" }, { 0xF000, 0x4000, "4XNN" }, { 0xF000, 0x5000, "5XY0" }, { 0xF000, 0x6000, "6XNN" },
+    { 0xF000, 0x7000, "7XNN" }, { 0xF00F, 0x8000, "8XY0" }, { 0xF00F, 0x8001, "8XY1" }, { 0xF00F, 0x8002, "8XY2" },
+    { 0xF00F, 0x8003, "8XY3" }, { 0xF00F, 0x8004, "8XY4" }, { 0xF00F, 0x8005, "8XY5" }, { 0xF00F, 0x8006, "8XY6" },
+    { 0xF00F, 0x8007, "8XY7" }, { 0xF00F, 0x800E, "8XYE" }, { 0xF000, 0x9000, "9XY0" }, { 0xF000, 0xA000, "ANNN" },
+    { 0xF000, 0xB000, "BNNN" }, { 0xF000, 0xC000, "CXNN" }, { 0xF000, 0xD000, "DXYN" }, { 0xF0FF, 0xE09E, "EX9E" },
+    { 0xF0FF, 0xE0A1, "EXA1" }, { 0xF0FF, 0xF007, "FX07" }, { 0xF0FF, 0xF00A, "FX0A" }, { 0xF0FF, 0xF015, "FX15" },
+    { 0xF0FF, 0xF018, "FX18" }, { 0xF0FF, 0xF01E, "FX1E" }, { 0xF0FF, 0xF029, "FX29" }, { 0xF0FF, 0xF033, "FX33" },
+    { 0xF0FF, 0xF055, "FX55" }, { 0xF0FF, 0xF065, "FX65" }, { 0x0000, 0x0000, "invalid" }
+};
+#endif
+
+/*  everything one emulated machine owns, so a process can host as many of them as it has threads for */
+struct  chip8_machine
+{
+    chip8_cpu_registers_struct          chip8_cpu_registers;
+    u16                                 call_stack[MAX_RECURSION_DEPTH + 1] = { };
+    u8                                  call_stack_depth = 0;
+    std::minstd_rand                    engine;
+    std::uniform_int_distribution<u8>   generator{0x00, 0xFF};
+
+    u8      memory[0x1000] = {  0xF0, 0x90, 0x90, 0x90, 0xF0,   //  0
+                                0x20, 0x60, 0x20, 0x20, 0x70,   //  1
+                                0xF0, 0x10, 0xF0, 0x80, 0xF0,   //  2
+                                0xF0, 0x10, 0xF0, 0x10, 0xF0,   //  3
+                                0x90, 0x90, 0xF0, 0x10, 0x10,   //  4
+                                0xF0, 0x80, 0xF0, 0x10, 0xF0,   //  5
+                                0xF0, 0x80, 0xF0, 0x90, 0xF0,   //  6
+                                0xF0, 0x10, 0x20, 0x40, 0x40,   //  7
+                                0xF0, 0x90, 0xF0, 0x90, 0xF0,   //  8
+                                0xF0, 0x90, 0xF0, 0x10, 0xF0,   //  9
+                                0xF0, 0x90, 0xF0, 0x90, 0x90,   //  A
+                                0xE0, 0x90, 0xE0, 0x90, 0xE0,   //  B
+                                0xF0, 0x80, 0x80, 0x80, 0xF0,   //  C
+                                0xE0, 0x90, 0x90, 0x90, 0xE0,   //  D
+                                0xF0, 0x80, 0xF0, 0x80, 0xF0,   //  E
+                                0xF0, 0x80, 0xF0, 0x80, 0x80    //  F   
+                            };
+    bool    keyboard_press[16] = { };
+    /*  register FX0A is waiting to receive a key in, the CPU is halted while this is set */
+    u8      key_wait_register = NO_KEY_WAIT;
+    uint64_t    screen_buffer[SCREEN_HEIGHT] = { };
+    /*  set by 00E0 and DXYN, the texture is only uploaded again once the framebuffer has changed */
+    bool    screen_dirty = true;
+    /*  non-empty once the machine has hit an error, the CPU stays halted from then on */
+    std::string fault;
+    /*  instructions actually fetched, cycles spent halted on FX0A or after a fault are not counted */
+    uint64_t    executed = 0;
+#if PROFILER_BUILD
+    /*  only the interactive/headless machine is profiled, batch machines leave this null */
+    chip8_profile_struct*   profiler = nullptr;
+#endif
+
+    void        rom_load(const std::vector<u8>& rom);
+    void        key_press(u8 key);
+    void        key_release(u8 key);
+    void        keyboard_update(u16 mask);
+    void        instruction_parse_and_execute(void);
+    void        timers_tick(void);
+    uint64_t    framebuffer_hash(void) const;
+    bool        framebuffer_write_pbm(const char* path) const;
+    void        state_save(chip8_state_struct& state) const;
+    void        state_load(const chip8_state_struct& state);
+};
+
+chip8_machine   machine;
+
+struct  run_options_struct {
+    bool            headless = HEADLESS_BUILD;
+    uint64_t        cycles = FRAME_START_CYCLE(HEADLESS_DEFAULT_FRAMES);
+    /*  negative picks the mode default: real time with a window, unthrottled headless */
+    double          speed = -1.0;
+    bool            seeded = false;
+    uint32_t        seed = 0;
+    const char*     input_path = nullptr;
+    const char*     pbm_path = nullptr;
+    bool            batch = false;
+    unsigned        threads = std::thread::hardware_concurrency();
+    const char*     load_state_path = nullptr;
+    const char*     save_state_path = nullptr;
+    std::string     default_state_path;
+    const char*     profile_path = PROFILE_DEFAULT_PATH;
+    const char*     record_path = nullptr;
+    /*  set by --cycles or --frames, which then win over the end of an input trace */
+    bool            cycles_given = false;
+    uint64_t        trace_end = UINT64_MAX;
+    bool            replay = false;
+}       run_options;
+
+/*  scripted input and recorded traces: from the given frame onwards, the keys set in the mask are held down */
+struct  input_event_struct {
+    uint64_t        frame;
+    u16             mask;
+};
+std::vector<input_event_struct>             input_script;
+
+struct  batch_job_struct {
+    std::string                         rom_path;
+    std::vector<u8>                     rom;
+    uint64_t                            frames = 0;
+    uint32_t                            seed = 0;
+    std::vector<input_event_struct>     script;
+
+    uint64_t                            hash = 0;
+    uint64_t                            executed = 0;
+    std::string                         fault;
+};
+
+/*  each worker pops from the front of its own queue and steals from the back of the others once it runs dry */
+struct  work_queue_struct {
+    std::mutex                          lock;
+    std::deque<size_t>                  jobs;
+};
+
+/*  a ring of per-frame snapshots, each XORed against the newest keyframe before it and zero-run compressed,
+    keyframes are compressed the same way against an all-zero state. The oldest entry is always a keyframe */
+struct  rewind_entry_struct {
+    bool                                keyframe;
+    std::vector<u8>                     data;
+};
+
+struct  rewind_buffer_struct {
+    std::deque<rewind_entry_struct>     entries;
+    /*  decoded copy of the newest keyframe in entries, the base for every delta after it */
+    chip8_state_struct                  keyframe = { };
+    chip8_state_struct                  scratch = { };
+    size_t                              since_keyframe = 0;
+    size_t                              bytes = 0;
+}       rewind_buffer;
+
+/*  keypad state and hotkeys seen by event_listener() on the main thread, only sampled by the emulation thread at the
+    next frame boundary so a trace of per-frame masks reproduces a session exactly. pressed keeps taps shorter than a
+    frame from being lost */
+struct  host_input_struct {
+    std::atomic<u16>                    keys{0};
+    std::atomic<u16>                    pressed{0};
+    std::atomic<bool>                   rewind_held{false};
+    std::atomic<bool>                   save_requested{false};
+    std::atomic<bool>                   load_requested{false};
+    std::atomic<bool>                   profile_requested{false};
+    std::atomic<bool>                   quit_requested{false};
+}       host_input;
 
+/*  the newest framebuffer, published by the emulation thread at frame boundaries for the present loop to pick up */
+struct  display_struct {
+    std::mutex                          lock;
+    uint64_t                            screen_buffer[SCREEN_HEIGHT] = { };
+    bool                                dirty = true;
+}       display;
+
+struct  trace_recorder_struct {
+    std::ofstream                       handle;
+    bool                                started = false;
+    u16                                 last_mask = 0;
+}       trace_recorder;
+
+/*  frames are paced against absolute deadlines measured from the epoch, so sleep jitter never accumulates */
+struct  scheduler_struct {
+    std::chrono::steady_clock::time_point   epoch;
+    uint64_t                                frame = 0;
+}       scheduler;
+
+#if !HEADLESS_BUILD
 struct  sdl2_internals_struct {
     SDL_Renderer*   renderer = nullptr;
 	SDL_Window*     window = nullptr;
+    SDL_Texture*    texture = nullptr;
 }       sdl2_internals;
+#endif
+
+void    chip8_machine::rom_load(const std::vector<u8>& rom) {
+    std::copy(rom.begin(), rom.end(), &memory[0x200]);
+}
+
+void    chip8_machine::key_press(u8 key) {
+    keyboard_press[key] = true;
+    if(key_wait_register != NO_KEY_WAIT) {
+        chip8_cpu_registers.v[key_wait_register] = key;
+        key_wait_register = NO_KEY_WAIT;
+    }
+}
+
+void    chip8_machine::key_release(u8 key) {
+    keyboard_press[key] = false;
+}
 
+void    chip8_machine::keyboard_update(u16 mask) {
+    for(u8 key = 0; key < 16; key++) {
+        bool pressed = BIT_CUT(mask, key, 1);
+        if(pressed && !keyboard_press[key]) {
+            key_press(key);
+        }
+        else if(!pressed && keyboard_press[key]) {
+            key_release(key);
+        }
+    }
+}
+
+#if !HEADLESS_BUILD
 void    event_listener(void) {
     SDL_Event   event;
 
     while(SDL_PollEvent(&event)) {
         switch(event.type) {
             case    SDL_QUIT:
-                exit(0);
+                host_input.quit_requested = true;
+                break;
             case    SDL_KEYDOWN:
                 switch(event.key.keysym.sym) {
                     SDL_KEYDOWN(0);
@@ -129,6 +429,18 @@ void    event_listener(void) {
                     SDL_KEYDOWN(d);
                     SDL_KEYDOWN(e);
                     SDL_KEYDOWN(f);
+                    case    SDLK_BACKSPACE:
+                        host_input.rewind_held = true;
+                        break;
+                    case    SDLK_F5:
+                        host_input.save_requested = true;
+                        break;
+                    case    SDLK_F9:
+                        host_input.load_requested = true;
+                        break;
+                    case    SDLK_F1:
+                        host_input.profile_requested = true;
+                        break;
                     default:
                         break;
                 }
@@ -151,6 +463,9 @@ void    event_listener(void) {
                     SDL_KEYUP(d);
                     SDL_KEYUP(e);
                     SDL_KEYUP(f);
+                    case    SDLK_BACKSPACE:
+                        host_input.rewind_held = false;
+                        break;
                     default:
                         break;
                 }
@@ -161,28 +476,50 @@ void    event_listener(void) {
         }
     }
 }
+#endif
 
-void    instruction_parse_and_execute(void) {
+void    chip8_machine::instruction_parse_and_execute(void) {
+    if(key_wait_register != NO_KEY_WAIT || !fault.empty()) {
+#if PROFILER_BUILD
+        if(profiler != nullptr) {
+            profiler->halted_cycles++;
+        }
+#endif
+        return;
+    }
+
+    MEMORY_CHECK(chip8_cpu_registers.pc, 2);
+    executed++;
     u16 instruction = (memory[chip8_cpu_registers.pc] << 8) + memory[chip8_cpu_registers.pc + 1];
+#if PROFILER_BUILD
+    if(profiler != nullptr) {
+        profiler->instruction_counts[instruction]++;
+        profiler->pc_counts[chip8_cpu_registers.pc & 0xFFF]++;
+    }
+#endif
     u8  instruction_hex[4u] = { (u8)BIT_CUT(instruction, 12, 4), (u8)BIT_CUT(instruction, 8, 4), (u8)BIT_CUT(instruction, 4, 4), (u8)BIT_CUT(instruction, 0, 4) };
 
     if(CMP_HEX(0, 0) && CMP_HEX(1, 0) && CMP_HEX(2, E) && CMP_HEX(3, 0)) {
-        memset(screen_buffer, 0, sizeof(bool) * SCREEN_WIDTH * SCREEN_HEIGHT);
+        memset(screen_buffer, 0, sizeof(screen_buffer));
+        screen_dirty = true;
     }
     else if(CMP_HEX(0, 0) && CMP_HEX(1, 0) && CMP_HEX(2, E) && CMP_HEX(3, E)) {
-        chip8_cpu_registers.pc = call_stack.top();
-        call_stack.pop();          
+        if(call_stack_depth == 0) {
+            MACHINE_FAULT(STACK_UNDERFLOW_ERROR);
+        }
+        call_stack_depth--;
+        chip8_cpu_registers.pc = call_stack[call_stack_depth];
     }
     else if(CMP_HEX(0, 1)) {
         /*  since PC is incremented by 2 always, offsetting */
         chip8_cpu_registers.pc = _NNN - 2;      
     }
     else if(CMP_HEX(0, 2)) {
-        if(call_stack.size() > MAX_RECURSION_DEPTH) {
-            std::cerr << STACK_OVERFLOW_ERROR;
-            exit(1);
+        if(call_stack_depth > MAX_RECURSION_DEPTH) {
+            MACHINE_FAULT(STACK_OVERFLOW_ERROR);
         }
-        call_stack.push(chip8_cpu_registers.pc);
+        call_stack[call_stack_depth] = chip8_cpu_registers.pc;
+        call_stack_depth++;
         chip8_cpu_registers.pc = _NNN - 2;        
     }
     else if(CMP_HEX(0, 3)) {
@@ -257,19 +594,28 @@ void    instruction_parse_and_execute(void) {
         vX = (generator(engine) & _NN);
     }
     else if(CMP_HEX(0, D)) {
+        /*  the starting position wraps, read it before vF gets clobbered in case X or Y is F */
+        u8 x = vX % SCREEN_WIDTH;
+        u8 y = vY % SCREEN_HEIGHT;
+
+        MEMORY_CHECK(chip8_cpu_registers.i, _N);
+        screen_dirty = true;
+        vF = 0;
         for(u8 i = 0; i < _N; i++) {
-            for(u8 j = 0; j < 8; j++) {
 #if CLIPPING_GRAPHICS
-                if((vY + i) >= SCREEN_HEIGHT) {
-                    continue;
-                }
+            if((y + i) >= SCREEN_HEIGHT) {
+                break;
+            }
 #endif
-                if(memory[chip8_cpu_registers.i] & (1 << (7 - j))) {
-                    vF = 1;
-                }
-                screen_buffer[(vX + j) % SCREEN_WIDTH][(vY + i) % SCREEN_HEIGHT] = screen_buffer[(vX + j) % SCREEN_WIDTH][(vY + i) % SCREEN_HEIGHT] ^ 
-                ((memory[chip8_cpu_registers.i + i] & (1 << (7 - j))) >> (7 - j));
-            }    
+            /*  rotating the sprite row into place wraps pixels past the right edge around, as before */
+            uint64_t sprite = (uint64_t)memory[chip8_cpu_registers.i + i] << (SCREEN_WIDTH - 8);
+            uint64_t* row = &screen_buffer[(y + i) % SCREEN_HEIGHT];
+
+            sprite = (sprite >> x) | (x ? (sprite << (SCREEN_WIDTH - x)) : 0);
+            if(*row & sprite) {
+                vF = 1;
+            }
+            *row = *row ^ sprite;
         }
     }
     else if(CMP_HEX(0, E) && CMP_HEX(2, 9) && CMP_HEX(3, E)) {
@@ -286,11 +632,8 @@ void    instruction_parse_and_execute(void) {
         vX = chip8_cpu_registers.delay_timer;
     } 
     else if(CMP_HEX(0, F) && CMP_HEX(2, 0) && CMP_HEX(3, A)) {
-        u8 cached_last_key_pressed = last_key_pressed;
-        while(last_key_pressed == cached_last_key_pressed) {
-            event_listener();
-        }
-        vX = last_key_pressed;
+        /*  halts the CPU instead of spinning here, key_press() fills in vX */
+        key_wait_register = _X;
     } 
     else if(CMP_HEX(0, F) && CMP_HEX(2, 1) && CMP_HEX(3, 5)) {
         chip8_cpu_registers.delay_timer = vX;
@@ -305,71 +648,866 @@ void    instruction_parse_and_execute(void) {
         chip8_cpu_registers.i = (0x5 * vX);
     }
     else if(CMP_HEX(0, F) && CMP_HEX(2, 3) && CMP_HEX(3, 3)) {
+        MEMORY_CHECK(chip8_cpu_registers.i, 3);
         memory[chip8_cpu_registers.i] = (vX / 100);
         memory[chip8_cpu_registers.i + 1] = ((vX / 10) % 10);
         memory[chip8_cpu_registers.i + 2] = (vX % 10);
     } 
     else if(CMP_HEX(0, F) && CMP_HEX(2, 5) && CMP_HEX(3, 5)) {
+        MEMORY_CHECK(chip8_cpu_registers.i, _X + 1);
         for(u8 i = 0; i <= _X; i++) {
             memory[chip8_cpu_registers.i + i] = chip8_cpu_registers.v[i];
         }
         chip8_cpu_registers.i++;
     }  
     else if(CMP_HEX(0, F) && CMP_HEX(2, 6) && CMP_HEX(3, 5)) {
+        MEMORY_CHECK(chip8_cpu_registers.i, _X + 1);
         for(u8 i = 0; i <= _X; i++) {
             chip8_cpu_registers.v[i] = memory[chip8_cpu_registers.i + i];
         }
         chip8_cpu_registers.i++;
     }
     else {
-        std::cerr << INVALID_OPCODE_ERROR;
-        exit(1);
+        MACHINE_FAULT(INVALID_OPCODE_ERROR);
     }
 
     chip8_cpu_registers.pc = chip8_cpu_registers.pc + 2;
     return;                                                          
 }
 
-void    screen_render(SDL_Renderer* renderer) {
-    for(int i = 0; i < SCREEN_WIDTH; i++) {
-        for(int j = 0; j < SCREEN_HEIGHT; j++) {
-            if(screen_buffer[i][j] == 1) {
-                for(int k = 0; k < SCALING_FACTOR; k++) {
-                    for(int l = 0; l < SCALING_FACTOR; l++) {
-                        SDL_RenderDrawPoint(renderer, (SCALING_FACTOR * i) + k, (SCALING_FACTOR * j) + l);
-                    }
+#if !HEADLESS_BUILD
+/*  expands the framebuffer into a streaming texture at native resolution, the renderer scales it up using SCALING_MODE */
+void    screen_render(SDL_Renderer* renderer, SDL_Texture* texture) {
+    uint64_t    screen_buffer[SCREEN_HEIGHT];
+    bool        dirty = false;
+
+    {
+        std::lock_guard<std::mutex> guard(display.lock);
+        if(display.dirty) {
+            std::copy(std::begin(display.screen_buffer), std::end(display.screen_buffer), screen_buffer);
+            display.dirty = false;
+            dirty = true;
+        }
+    }
+    if(dirty) {
+        void*   pixels = nullptr;
+        int     pitch = 0;
+
+        if(SDL_LockTexture(texture, nullptr, &pixels, &pitch) == 0) {
+            for(int j = 0; j < SCREEN_HEIGHT; j++) {
+                uint32_t* row = reinterpret_cast<uint32_t*>(static_cast<u8*>(pixels) + j * pitch);
+                for(int i = 0; i < SCREEN_WIDTH; i++) {
+                    row[i] = SCREEN_PIXEL(screen_buffer, i, j) ? PIXEL_ON_COLOUR : PIXEL_OFF_COLOUR;
                 }
             }
+            SDL_UnlockTexture(texture);
         }
     }
+    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
 }
 
-void    timer_audio_thread(void) {
-    while(true) {
-        if(chip8_cpu_registers.delay_timer > 0) {
-            chip8_cpu_registers.delay_timer--;
+#endif
+
+void    chip8_machine::timers_tick(void) {
+#if PROFILER_BUILD
+    if(profiler != nullptr) {
+        profiler->frames++;
+    }
+#endif
+    if(chip8_cpu_registers.delay_timer > 0) {
+        chip8_cpu_registers.delay_timer--;
+    }
+    if(chip8_cpu_registers.sound_timer > 0) {
+        chip8_cpu_registers.sound_timer--;
+    }
+}
+
+void    scheduler_start(void) {
+    scheduler.epoch = std::chrono::steady_clock::now();
+    scheduler.frame = 0;
+}
+
+/*  ends the current emulated frame by sleeping until the next frame's deadline, the caller ticks the timers */
+void    scheduler_end_frame(void) {
+    scheduler.frame++;
+    if(run_options.speed <= 0) {
+        return;
+    }
+
+    std::chrono::duration<double> frame_period(1.0 / (FRAME_RATE * run_options.speed));
+    auto deadline = scheduler.epoch + std::chrono::duration_cast<std::chrono::steady_clock::duration>(frame_period * scheduler.frame);
+    auto now = std::chrono::steady_clock::now();
+
+    if(now - deadline > frame_period * MAX_FRAME_LAG) {
+        /*  fell too far behind (debugger, suspended window), rebase instead of fast-forwarding to catch up */
+        scheduler.epoch = now - std::chrono::duration_cast<std::chrono::steady_clock::duration>(frame_period * scheduler.frame);
+        return;
+    }
+    std::this_thread::sleep_until(deadline);
+}
+
+bool    input_script_load(const char* path, std::vector<input_event_struct>& script, bool* seeded = nullptr, uint32_t* seed = nullptr, uint64_t* end = nullptr) {
+    std::ifstream   script_handle(path);
+    std::string     line;
+
+    if(!script_handle) {
+        return false;
+    }
+    while(std::getline(script_handle, line)) {
+        std::istringstream  line_stream(line);
+        input_event_struct  event;
+
+        if(line.empty() || line[0] == '#') {
+            continue;
+        }
+        if(line.compare(0, 5, "seed ") == 0) {
+            std::string keyword;
+            uint32_t    trace_seed = 0;
+
+            if(!(line_stream >> keyword >> std::dec >> trace_seed)) {
+                return false;
+            }
+            if(seeded != nullptr && seed != nullptr) {
+                *seeded = true;
+                *seed = trace_seed;
+            }
+            continue;
+        }
+        if(line.compare(0, 4, "end ") == 0) {
+            std::string keyword;
+            uint64_t    trace_end = 0;
+
+            if(!(line_stream >> keyword >> std::dec >> trace_end)) {
+                return false;
+            }
+            if(end != nullptr) {
+                *end = trace_end;
+            }
+            continue;
         }
-        if(chip8_cpu_registers.sound_timer > 0) {
-            chip8_cpu_registers.sound_timer--;
+        if(!(line_stream >> std::dec >> event.frame >> std::hex >> event.mask)) {
+            return false;
         }
+        script.push_back(event);
+    }
+    return true;
+}
+
+/*  FNV-1a over the framebuffer rows, each row fed MSB first */
+uint64_t    chip8_machine::framebuffer_hash(void) const {
+    uint64_t hash = 0xCBF29CE484222325;
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000 / 60));        
+    for(int j = 0; j < SCREEN_HEIGHT; j++) {
+        for(int k = 7; k >= 0; k--) {
+            hash = (hash ^ BIT_CUT(screen_buffer[j], 8 * k, 8)) * 0x100000001B3;
+        }
     }
+    return hash;
 }
 
-int     main(int argc, char** argv) {
-    std::ifstream file_handle(argv[argc - 1u], std::ios::in | std::ios::binary);
+bool    chip8_machine::framebuffer_write_pbm(const char* path) const {
+    std::ofstream pbm_handle(path, std::ios::out | std::ios::binary);
+
+    pbm_handle << "P4\n" << SCREEN_WIDTH << " " << SCREEN_HEIGHT << "\n";
+    for(int j = 0; j < SCREEN_HEIGHT; j++) {
+        for(int k = 7; k >= 0; k--) {
+            pbm_handle.put((char)BIT_CUT(screen_buffer[j], 8 * k, 8));
+        }
+    }
+    return pbm_handle.good();
+}
+
+void    chip8_machine::state_save(chip8_state_struct& state) const {
+    state.chip8_cpu_registers = chip8_cpu_registers;
+    std::copy(std::begin(memory), std::end(memory), state.memory);
+    std::copy(std::begin(screen_buffer), std::end(screen_buffer), state.screen_buffer);
+    std::copy(std::begin(call_stack), std::end(call_stack), state.call_stack);
+    state.call_stack_depth = call_stack_depth;
+    std::copy(std::begin(keyboard_press), std::end(keyboard_press), state.keyboard_press);
+    state.key_wait_register = key_wait_register;
+    state.engine = engine;
+}
+
+void    chip8_machine::state_load(const chip8_state_struct& state) {
+    chip8_cpu_registers = state.chip8_cpu_registers;
+    std::copy(std::begin(state.memory), std::end(state.memory), memory);
+    std::copy(std::begin(state.screen_buffer), std::end(state.screen_buffer), screen_buffer);
+    std::copy(std::begin(state.call_stack), std::end(state.call_stack), call_stack);
+    call_stack_depth = state.call_stack_depth;
+    std::copy(std::begin(state.keyboard_press), std::end(state.keyboard_press), keyboard_press);
+    key_wait_register = state.key_wait_register;
+    engine = state.engine;
+    screen_dirty = true;
+    fault.clear();
+}
+
+bool    state_write(const char* path, const chip8_machine& source) {
+    std::ofstream       state_handle(path, std::ios::out | std::ios::binary);
+    chip8_state_struct  state = { };
+    uint32_t            size = sizeof(state);
+
+    source.state_save(state);
+    state_handle.write(STATE_FILE_MAGIC, strlen(STATE_FILE_MAGIC));
+    state_handle.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    state_handle.write(reinterpret_cast<const char*>(&state), sizeof(state));
+    return state_handle.good();
+}
+
+/*  a state file is untrusted input, every field used as an index has to stay inside the array it indexes */
+bool    state_valid(const chip8_state_struct& state) {
+    if(state.chip8_cpu_registers.pc > sizeof(state.memory) - 2 || state.chip8_cpu_registers.i >= sizeof(state.memory)) {
+        return false;
+    }
+    if(state.call_stack_depth > MAX_RECURSION_DEPTH + 1) {
+        return false;
+    }
+    for(u8 depth = 0; depth < state.call_stack_depth; depth++) {
+        if(state.call_stack[depth] > sizeof(state.memory) - 2) {
+            return false;
+        }
+    }
+    /*  a bool holding anything but 0 or 1 is undefined, so the keys are looked at as raw bytes */
+    for(u8 key = 0; key < 16; key++) {
+        if(reinterpret_cast<const u8*>(state.keyboard_press)[key] > 1) {
+            return false;
+        }
+    }
+    return state.key_wait_register < 16 || state.key_wait_register == NO_KEY_WAIT;
+}
+
+bool    state_read(const char* path, chip8_machine& target) {
+    std::ifstream       state_handle(path, std::ios::in | std::ios::binary);
+    chip8_state_struct  state = { };
+    char                magic[sizeof(STATE_FILE_MAGIC) - 1] = { };
+    uint32_t            size = 0;
+
+    state_handle.read(magic, sizeof(magic));
+    state_handle.read(reinterpret_cast<char*>(&size), sizeof(size));
+    if(!state_handle || memcmp(magic, STATE_FILE_MAGIC, sizeof(magic)) != 0 || size != sizeof(state)) {
+        return false;
+    }
+    state_handle.read(reinterpret_cast<char*>(&state), sizeof(state));
+    if(!state_handle || !state_valid(state)) {
+        return false;
+    }
+    target.state_load(state);
+    return true;
+}
+
+void    varint_put(std::vector<u8>& out, size_t value) {
+    while(value >= 0x80) {
+        out.push_back((u8)(value | 0x80));
+        value = value >> 7;
+    }
+    out.push_back((u8)value);
+}
+
+size_t  varint_get(const std::vector<u8>& in, size_t& position) {
+    size_t  value = 0;
+    int     shift = 0;
+
+    while(in[position] & 0x80) {
+        value = value | ((size_t)(in[position++] & 0x7F) << shift);
+        shift = shift + 7;
+    }
+    return value | ((size_t)in[position++] << shift);
+}
+
+/*  encodes state XOR base as alternating [zero run length][literal length][literal bytes], base == nullptr means all zeroes */
+void    state_delta_encode(const chip8_state_struct& state, const chip8_state_struct* base, std::vector<u8>& out) {
+    const u8*   current = reinterpret_cast<const u8*>(&state);
+    const u8*   previous = reinterpret_cast<const u8*>(base);
+    size_t      position = 0;
+
+    #define     DELTA_BYTE(k)           (u8)(current[k] ^ (previous ? previous[k] : 0))
+    while(position < sizeof(state)) {
+        size_t zero_start = position;
+        while(position < sizeof(state) && DELTA_BYTE(position) == 0) {
+            position++;
+        }
+        size_t literal_start = position;
+        /*  a literal run only ends at two consecutive zeroes, single zero bytes are cheaper to copy than to split on */
+        while(position < sizeof(state) && !(DELTA_BYTE(position) == 0 && (position + 1 == sizeof(state) || DELTA_BYTE(position + 1) == 0))) {
+            position++;
+        }
+        varint_put(out, literal_start - zero_start);
+        varint_put(out, position - literal_start);
+        for(size_t k = literal_start; k < position; k++) {
+            out.push_back(DELTA_BYTE(k));
+        }
+    }
+    #undef      DELTA_BYTE
+}
+
+void    state_delta_decode(const std::vector<u8>& in, const chip8_state_struct* base, chip8_state_struct& state) {
+    u8*     current = reinterpret_cast<u8*>(&state);
+    size_t  position = 0;
+    size_t  offset = 0;
+
+    if(base != nullptr) {
+        state = *base;
+    }
+    else {
+        memset(current, 0, sizeof(state));
+    }
+    while(position < in.size()) {
+        offset = offset + varint_get(in, position);
+        size_t literal_length = varint_get(in, position);
+        for(size_t k = 0; k < literal_length; k++) {
+            current[offset++] ^= in[position++];
+        }
+    }
+}
+
+/*  snapshots the machine at a frame boundary, evicting the oldest keyframe group once the ring is full */
+void    rewind_push(const chip8_machine& source) {
+    rewind_entry_struct entry;
+
+    source.state_save(rewind_buffer.scratch);
+    entry.keyframe = (rewind_buffer.entries.empty() || rewind_buffer.since_keyframe >= REWIND_KEYFRAME_INTERVAL);
+    if(entry.keyframe) {
+        state_delta_encode(rewind_buffer.scratch, nullptr, entry.data);
+        rewind_buffer.keyframe = rewind_buffer.scratch;
+        rewind_buffer.since_keyframe = 0;
+    }
+    else {
+        state_delta_encode(rewind_buffer.scratch, &rewind_buffer.keyframe, entry.data);
+    }
+    rewind_buffer.since_keyframe++;
+    rewind_buffer.bytes = rewind_buffer.bytes + entry.data.size();
+    rewind_buffer.entries.push_back(std::move(entry));
+
+    while(rewind_buffer.entries.size() > REWIND_SECONDS * FRAME_RATE) {
+        do {
+            rewind_buffer.bytes = rewind_buffer.bytes - rewind_buffer.entries.front().data.size();
+            rewind_buffer.entries.pop_front();
+        } while(!rewind_buffer.entries.empty() && !rewind_buffer.entries.front().keyframe);
+    }
+}
+
+/*  restores the newest snapshot and drops it, returns false once there is no history left */
+bool    rewind_pop(chip8_machine& target) {
+    if(rewind_buffer.entries.empty()) {
+        return false;
+    }
+
+    const rewind_entry_struct& entry = rewind_buffer.entries.back();
+    state_delta_decode(entry.data, entry.keyframe ? nullptr : &rewind_buffer.keyframe, rewind_buffer.scratch);
+    target.state_load(rewind_buffer.scratch);
+    rewind_buffer.bytes = rewind_buffer.bytes - entry.data.size();
+    rewind_buffer.entries.pop_back();
+    rewind_buffer.since_keyframe--;
+
+    if(rewind_buffer.since_keyframe == 0 && !rewind_buffer.entries.empty()) {
+        size_t index = rewind_buffer.entries.size() - 1;
+        while(!rewind_buffer.entries[index].keyframe) {
+            index--;
+        }
+        state_delta_decode(rewind_buffer.entries[index].data, nullptr, rewind_buffer.keyframe);
+        rewind_buffer.since_keyframe = rewind_buffer.entries.size() - index;
+    }
+    return true;
+}
+
+#if PROFILER_BUILD
+void    profile_timer_write(std::ostream& out, const char* name, const profile_timer_struct& timer) {
+    double      seconds = std::chrono::duration<double>(std::chrono::steady_clock::duration(timer.ticks)).count();
+    uint64_t    calls = timer.calls;
+
+    out << "  \"" << name << "\": { \"calls\": " << calls << ", \"seconds\": " << seconds;
+    out << ", \"mean_ns\": " << (calls ? seconds * 1e9 / calls : 0.0) << " },\n";
+}
+
+bool    profile_write(const char* path) {
+    std::ofstream   profile_handle(path);
+    uint64_t        class_counts[sizeof(opcode_classes) / sizeof(opcode_classes[0])] = { };
+    uint64_t        instructions = 0;
+    double          host_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - profile.start).count();
+    double          emulated_seconds = (double)profile.frames / FRAME_RATE;
+    bool            first = true;
 
+    for(uint32_t instruction = 0; instruction < 0x10000; instruction++) {
+        size_t k = 0;
+        while((instruction & opcode_classes[k].mask) != opcode_classes[k].value) {
+            k++;
+        }
+        class_counts[k] += profile.instruction_counts[instruction];
+        instructions += profile.instruction_counts[instruction];
+    }
+
+    profile_handle << "{\n";
+    profile_handle << "  \"host_seconds\": " << host_seconds << ",\n";
+    profile_handle << "  \"emulated_seconds\": " << emulated_seconds << ",\n";
+    profile_handle << "  \"frames\": " << profile.frames << ",\n";
+    profile_handle << "  \"instructions\": " << instructions << ",\n";
+    profile_handle << "  \"halted_cycles\": " << profile.halted_cycles << ",\n";
+    profile_handle << "  \"instructions_per_host_second\": " << (host_seconds > 0 ? instructions / host_seconds : 0.0) << ",\n";
+    profile_handle << "  \"instructions_per_emulated_second\": " << (emulated_seconds > 0 ? instructions / emulated_seconds : 0.0) << ",\n";
+    profile_timer_write(profile_handle, "event_listener", profile.event_listener);
+    profile_timer_write(profile_handle, "screen_render", profile.screen_render);
+
+    profile_handle << "  \"opcodes\": {";
+    for(size_t k = 0; k < sizeof(opcode_classes) / sizeof(opcode_classes[0]); k++) {
+        if(class_counts[k] != 0) {
+            profile_handle << (first ? "\n" : ",\n") << "    \"" << opcode_classes[k].name << "\": " << class_counts[k];
+            first = false;
+        }
+    }
+    profile_handle << "\n  },\n";
+
+    first = true;
+    profile_handle << "  \"pc\": {";
+    for(u16 pc = 0; pc < 0x1000; pc++) {
+        if(profile.pc_counts[pc] != 0) {
+            profile_handle << (first ? "\n" : ",\n") << "    \"0x" << std::hex << pc << std::dec << "\": " << profile.pc_counts[pc];
+            first = false;
+        }
+    }
+    profile_handle << "\n  }\n}\n";
+    return profile_handle.good();
+}
+
+void    profile_write_at_exit(void) {
+    if(!profile_write(run_options.profile_path)) {
+        std::cerr << PROFILE_WRITE_ERROR;
+    }
+}
+#endif
+
+bool    rom_read(const char* path, std::vector<u8>& rom) {
+    std::ifstream file_handle(path, std::ios::in | std::ios::binary);
+
+    if(!file_handle) {
+        return false;
+    }
     file_handle.ignore(std::numeric_limits<std::streamsize>::max());
     std::streamsize size = file_handle.gcount();
-    assert(size < (0x1000 - 0x200));
+    if(size >= (0x1000 - 0x200)) {
+        return false;
+    }
     file_handle.clear();  
     file_handle.seekg(0, std::ios_base::beg);
-    u8* file_data = &memory[0x200];
-    file_handle.read(reinterpret_cast<char*>(file_data), size);
+    rom.resize(size);
+    file_handle.read(reinterpret_cast<char*>(rom.data()), size);
+    return true;
+}
+
+/*  steps through the script up to the given frame, returning the key mask held during it */
+u16     input_script_advance(const std::vector<input_event_struct>& script, size_t& next_event, uint64_t frame, u16 mask) {
+    while(next_event < script.size() && script[next_event].frame <= frame) {
+        mask = script[next_event].mask;
+        next_event++;
+    }
+    return mask;
+}
+
+bool    trace_record_start(const char* path, uint32_t seed) {
+    trace_recorder.handle.open(path);
+    trace_recorder.handle << "# chip8 input trace: FRAME KEYMASK, the mask is held from that frame on" << "\n";
+    trace_recorder.handle << "seed " << seed << "\n";
+    return trace_recorder.handle.good();
+}
+
+/*  only frames where the key mask changed are written out */
+void    trace_record(uint64_t frame, u16 mask) {
+    if(!trace_recorder.handle.is_open() || (trace_recorder.started && mask == trace_recorder.last_mask)) {
+        return;
+    }
+    trace_recorder.handle << frame << " " << std::hex << mask << std::dec << "\n";
+    trace_recorder.started = true;
+    trace_recorder.last_mask = mask;
+}
+
+/*  marks how many frames the session ran, only whole frames are recorded */
+void    trace_record_end(uint64_t frames) {
+    if(trace_recorder.handle.is_open()) {
+        trace_recorder.handle << "end " << frames << "\n";
+        trace_recorder.handle.flush();
+    }
+}
+
+/*  runs the machine for the given number of instructions, feeding the input script at frame starts and logging it to
+    the trace recorder if asked to. Returns the number of frames completed */
+uint64_t    machine_run(chip8_machine& target, uint64_t cycles, const std::vector<input_event_struct>& script, bool paced, bool recorded) {
+    size_t      next_event = 0;
+    u16         mask = 0;
+    uint64_t    frame = 0;
+
+    for(uint64_t cycle = 0; cycle < cycles && target.fault.empty(); cycle++) {
+        if(cycle == FRAME_START_CYCLE(frame)) {
+            mask = input_script_advance(script, next_event, frame, mask);
+            target.keyboard_update(mask);
+            if(recorded) {
+                trace_record(frame, mask);
+            }
+        }
+        target.instruction_parse_and_execute();
+        if(cycle + 1 == FRAME_START_CYCLE(frame + 1)) {
+            target.timers_tick();
+            frame++;
+            if(paced) {
+                scheduler_end_frame();
+            }
+        }
+    }
+    return frame;
+}
+
+void    headless_run(void) {
+    auto start = std::chrono::steady_clock::now();
+
+    scheduler_start();
+    uint64_t frames = machine_run(machine, run_options.cycles, input_script, run_options.speed > 0, true);
+    trace_record_end(frames);
+    if(!machine.fault.empty()) {
+        std::cerr << machine.fault;
+        exit(1);
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+
+    std::cout << "Ran " << run_options.cycles << " cycles (" << frames << " frames), executing " << machine.executed << " instructions in " << seconds << " seconds.\n";
+    if(seconds > 0) {
+        std::cout << "Emulated instructions per second: " << (uint64_t)(machine.executed / seconds) << ".\n";
+    }
+    std::cout << "RNG seed: " << run_options.seed << ".\n";
+    std::cout << "Framebuffer hash: " << std::hex << machine.framebuffer_hash() << std::dec << ".\n";
+    if(run_options.pbm_path != nullptr && !machine.framebuffer_write_pbm(run_options.pbm_path)) {
+        std::cerr << PBM_WRITE_ERROR;
+        exit(1);
+    }
+    if(run_options.save_state_path != nullptr && !state_write(run_options.save_state_path, machine)) {
+        std::cerr << STATE_SAVE_ERROR;
+        exit(1);
+    }
+}
+
+bool    batch_load(const char* path, std::vector<batch_job_struct>& jobs) {
+    std::ifstream   batch_handle(path);
+    std::string     line;
+
+    if(!batch_handle) {
+        return false;
+    }
+    while(std::getline(batch_handle, line)) {
+        std::istringstream  line_stream(line);
+        batch_job_struct    job;
+        std::string         input_path;
+
+        if(line.empty() || line[0] == '#') {
+            continue;
+        }
+        if(!(line_stream >> job.rom_path >> job.frames >> job.seed)) {
+            return false;
+        }
+        /*  a job that cannot be loaded keeps its line and reports the fault in its result, like a runtime fault */
+        std::ostringstream  fault_stream;
+        const char*         path = job.rom_path.c_str();
+
+        if(!rom_read(path, job.rom)) {
+            fault_stream << ROM_LOAD_ERROR;
+        }
+        else if(line_stream >> input_path && !input_script_load(input_path.c_str(), job.script)) {
+            fault_stream << BATCH_INPUT_ERROR;
+        }
+        job.fault = fault_stream.str();
+        jobs.push_back(std::move(job));
+    }
+    return true;
+}
+
+void    batch_run_job(batch_job_struct& job) {
+    chip8_machine instance;
+
+    if(!job.fault.empty()) {
+        return;
+    }
+    instance.rom_load(job.rom);
+    instance.engine.seed(job.seed);
+    machine_run(instance, FRAME_START_CYCLE(job.frames), job.script, false, false);
+    job.hash = instance.framebuffer_hash();
+    job.executed = instance.executed;
+    job.fault = instance.fault;
+}
+
+void    batch_worker(size_t id, std::vector<work_queue_struct>& queues, std::vector<batch_job_struct>& jobs) {
+    while(true) {
+        size_t  job = 0;
+        bool    found = false;
+
+        for(size_t k = 0; k < queues.size() && !found; k++) {
+            work_queue_struct& queue = queues[(id + k) % queues.size()];
+            std::lock_guard<std::mutex> guard(queue.lock);
+
+            if(!queue.jobs.empty()) {
+                if(k == 0) {
+                    job = queue.jobs.front();
+                    queue.jobs.pop_front();
+                }
+                else {
+                    job = queue.jobs.back();
+                    queue.jobs.pop_back();
+                }
+                found = true;
+            }
+        }
+        /*  jobs are never added once running, so every queue being empty means we are done */
+        if(!found) {
+            return;
+        }
+        batch_run_job(jobs[job]);
+    }
+}
+
+void    batch_run(const char* path) {
+    std::vector<batch_job_struct>   jobs;
+    uint64_t                        frames = 0;
+    uint64_t                        executed = 0;
+    unsigned                        threads_count = std::max(run_options.threads, 1u);
 
-    engine.seed(hrng());
+    if(!batch_load(path, jobs)) {
+        std::cerr << BATCH_LOAD_ERROR;
+        exit(1);
+    }
+
+    std::vector<work_queue_struct>  queues(threads_count);
+    std::vector<std::thread>        thread_array;
+
+    for(size_t i = 0; i < jobs.size(); i++) {
+        queues[i % threads_count].jobs.push_back(i);
+        if(jobs[i].fault.empty()) {
+            frames = frames + jobs[i].frames;
+        }
+    }
 
+    auto start = std::chrono::steady_clock::now();
+    for(unsigned i = 0; i < threads_count; i++) {
+        thread_array.emplace_back(batch_worker, i, std::ref(queues), std::ref(jobs));
+    }
+    for(std::thread& thread : thread_array) {
+        thread.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+
+    for(const batch_job_struct& job : jobs) {
+        executed = executed + job.executed;
+        std::cout << job.rom_path << " " << job.frames << " " << job.seed << " ";
+        if(job.fault.empty()) {
+            std::cout << std::hex << job.hash << std::dec << "\n";
+        }
+        else {
+            std::cout << "FAULT " << job.fault;
+        }
+    }
+    std::cout << "Ran " << jobs.size() << " jobs, " << frames << " frames on " << threads_count << " threads in " << seconds << " seconds.\n";
+    if(seconds > 0) {
+        std::cout << "Emulated frames per second: " << (uint64_t)(frames / seconds) << ".\n";
+        std::cout << "Emulated instructions per second: " << (uint64_t)(executed / seconds) << ".\n";
+    }
+}
+
+#if !HEADLESS_BUILD
+/*  copies the framebuffer out for the present loop whenever a frame has changed it */
+void    display_publish(void) {
+    if(machine.screen_dirty) {
+        std::lock_guard<std::mutex> guard(display.lock);
+        std::copy(std::begin(machine.screen_buffer), std::end(machine.screen_buffer), display.screen_buffer);
+        display.dirty = true;
+        machine.screen_dirty = false;
+    }
+}
+
+/*  owns the machine while the window is up: samples input once per frame, runs the frame's full instruction budget and
+    paces itself with the scheduler, independently of how often the main thread presents */
+void    emulation_loop(void) {
+    uint64_t    frame = 0;
+    size_t      next_event = 0;
+    u16         keys = 0;
+    /*  a trace has no record of the machine being rewound or reloaded, replaying it would diverge */
+    bool        traced = (run_options.record_path != nullptr || run_options.replay);
+    bool        rewinding = false;
+
+    scheduler_start();
+    while(!host_input.quit_requested) {
+        /*  a replay stops where the recording did and leaves its last frame on screen */
+        if(run_options.replay && frame >= run_options.trace_end) {
+            break;
+        }
+        if(traced && host_input.rewind_held && !rewinding) {
+            std::cerr << TRACE_LOCKED_ERROR;
+        }
+        rewinding = host_input.rewind_held;
+        if(!(rewinding && !traced && rewind_pop(machine))) {
+            if(run_options.replay) {
+                keys = input_script_advance(input_script, next_event, frame, keys);
+            }
+            else {
+                keys = host_input.keys | host_input.pressed.exchange(0);
+            }
+            machine.keyboard_update(keys);
+            trace_record(frame, keys);
+
+            for(uint64_t cycle = FRAME_START_CYCLE(frame); cycle < FRAME_START_CYCLE(frame + 1); cycle++) {
+                machine.instruction_parse_and_execute();
+            }
+            frame++;
+            /*  the main thread may be inside SDL, so the fault is only reported once it has left the loop and joined us */
+            if(!machine.fault.empty()) {
+                host_input.quit_requested = true;
+                break;
+            }
+            machine.timers_tick();
+            rewind_push(machine);
+        }
+        if(host_input.save_requested.exchange(false)) {
+            if(!state_write(run_options.save_state_path, machine)) {
+                std::cerr << STATE_SAVE_ERROR;
+            }
+        }
+        if(host_input.load_requested.exchange(false)) {
+            if(traced) {
+                std::cerr << TRACE_LOCKED_ERROR;
+            }
+            else if(!state_read(run_options.load_state_path, machine)) {
+                std::cerr << STATE_LOAD_ERROR;
+            }
+        }
+#if PROFILER_BUILD
+        if(host_input.profile_requested.exchange(false)) {
+            profile_write_at_exit();
+        }
+#endif
+        display_publish();
+        scheduler_end_frame();
+    }
+    trace_record_end(frame);
+}
+#endif
+
+int     main(int argc, char** argv) {
+    if(argc < 2) {
+        std::cerr << USAGE_ERROR;
+        exit(1);
+    }
+    for(int arg = 1; arg < argc - 1; arg++) {
+        bool has_value = (arg + 1 < argc - 1);
+
+        if(strcmp(argv[arg], "--headless") == 0) {
+            run_options.headless = true;
+        }
+        else if(strcmp(argv[arg], "--speed") == 0 && has_value) {
+            run_options.speed = std::strtod(argv[++arg], nullptr);
+        }
+        else if(strcmp(argv[arg], "--cycles") == 0 && has_value) {
+            run_options.cycles = std::strtoull(argv[++arg], nullptr, 0);
+            run_options.cycles_given = true;
+        }
+        else if(strcmp(argv[arg], "--frames") == 0 && has_value) {
+            run_options.cycles = FRAME_START_CYCLE(std::strtoull(argv[++arg], nullptr, 0));
+            run_options.cycles_given = true;
+        }
+        else if(strcmp(argv[arg], "--seed") == 0 && has_value) {
+            run_options.seeded = true;
+            run_options.seed = std::strtoul(argv[++arg], nullptr, 0);
+        }
+        else if(strcmp(argv[arg], "--input") == 0 && has_value) {
+            run_options.input_path = argv[++arg];
+        }
+        else if(strcmp(argv[arg], "--replay") == 0 && has_value) {
+            run_options.input_path = argv[++arg];
+            run_options.replay = true;
+        }
+        else if(strcmp(argv[arg], "--record") == 0 && has_value) {
+            run_options.record_path = argv[++arg];
+        }
+        else if(strcmp(argv[arg], "--dump-pbm") == 0 && has_value) {
+            run_options.pbm_path = argv[++arg];
+        }
+        else if(strcmp(argv[arg], "--load-state") == 0 && has_value) {
+            run_options.load_state_path = argv[++arg];
+        }
+        else if(strcmp(argv[arg], "--save-state") == 0 && has_value) {
+            run_options.save_state_path = argv[++arg];
+        }
+        else if(strcmp(argv[arg], "--profile") == 0 && has_value) {
+            run_options.profile_path = argv[++arg];
+        }
+        else if(strcmp(argv[arg], "--batch") == 0) {
+            run_options.batch = true;
+        }
+        else if(strcmp(argv[arg], "--threads") == 0 && has_value) {
+            run_options.threads = std::strtoul(argv[++arg], nullptr, 0);
+        }
+        else {
+            std::cerr << USAGE_ERROR;
+            exit(1);
+        }
+    }
+    if(run_options.batch) {
+        batch_run(argv[argc - 1u]);
+        return 0;
+    }
+    bool        trace_seeded = false;
+    uint32_t    trace_seed = 0;
+
+    if(run_options.load_state_path != nullptr && (run_options.record_path != nullptr || run_options.replay)) {
+        std::cerr << TRACE_STATE_ERROR;
+        exit(1);
+    }
+    if(run_options.input_path != nullptr && !input_script_load(run_options.input_path, input_script, &trace_seeded, &trace_seed, &run_options.trace_end)) {
+        std::cerr << INPUT_SCRIPT_ERROR;
+        exit(1);
+    }
+    if(run_options.trace_end != UINT64_MAX && !run_options.cycles_given) {
+        run_options.cycles = FRAME_START_CYCLE(run_options.trace_end);
+    }
+    if(trace_seeded && !run_options.seeded) {
+        run_options.seeded = true;
+        run_options.seed = trace_seed;
+    }
+
+    const char*     path = argv[argc - 1u];
+    std::vector<u8> rom;
+
+    if(!rom_read(path, rom)) {
+        std::cerr << ROM_LOAD_ERROR;
+        exit(1);
+    }
+    machine.rom_load(rom);
+
+    if(!run_options.seeded) {
+        run_options.seed = hrng();
+    }
+    machine.engine.seed(run_options.seed);
+    if(run_options.record_path != nullptr && !trace_record_start(run_options.record_path, run_options.seed)) {
+        std::cerr << TRACE_RECORD_ERROR;
+        exit(1);
+    }
+    if(run_options.load_state_path != nullptr && !state_read(run_options.load_state_path, machine)) {
+        std::cerr << STATE_LOAD_ERROR;
+        exit(1);
+    }
+    if(run_options.speed < 0) {
+        run_options.speed = run_options.headless ? 0.0 : 1.0;
+    }
+
+#if PROFILER_BUILD
+    machine.profiler = &profile;
+    profile.start = std::chrono::steady_clock::now();
+    std::atexit(profile_write_at_exit);
+#endif
+
+    if(run_options.headless) {
+        headless_run();
+        return 0;
+    }
+
+#if HEADLESS_BUILD
+    std::cerr << HEADLESS_BUILD_ERROR;
+    exit(1);
+#else
     if(SDL_Init(SDL_INIT_VIDEO) < 0) {
         std::cerr << INIT_SDL_ERROR;
         exit(1);     
@@ -381,27 +1519,57 @@ int     main(int argc, char** argv) {
         exit(1);     
     }
     SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, SCALING_MODE);
-    sdl2_internals.renderer = SDL_CreateRenderer(sdl2_internals.window, -1, SDL_RENDERER_ACCELERATED);
+    sdl2_internals.renderer = SDL_CreateRenderer(sdl2_internals.window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
     if(sdl2_internals.renderer == nullptr) {
         std::cerr << INIT_SDL_ERROR;
         exit(1);        
     }
+    sdl2_internals.texture = SDL_CreateTexture(sdl2_internals.renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, 
+        SCREEN_WIDTH, SCREEN_HEIGHT);
+    if(sdl2_internals.texture == nullptr) {
+        std::cerr << INIT_SDL_ERROR;
+        exit(1);        
+    }
 
-    std::thread thread_dispatch(timer_audio_thread);
+    run_options.default_state_path = std::string(path) + ".state";
+    if(run_options.save_state_path == nullptr) {
+        run_options.save_state_path = run_options.default_state_path.c_str();
+    }
+    if(run_options.load_state_path == nullptr) {
+        run_options.load_state_path = run_options.save_state_path;
+    }
 
-    while(true) {
-        SDL_SetRenderDrawColor(sdl2_internals.renderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
-        SDL_RenderClear(sdl2_internals.renderer);
-        SDL_SetRenderDrawColor(sdl2_internals.renderer, 255, 255, 255, SDL_ALPHA_OPAQUE);   
-        screen_render(sdl2_internals.renderer); 
-
-        for(int i = 0; i < INST_PER_CLOCK; i++) {
-            event_listener();
-            instruction_parse_and_execute();
-        }    
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000 / CPU_FREQUENCY));  
+    /*  presents are paced by vsync where the renderer supports it, otherwise by sleeping for one refresh period */
+    SDL_RendererInfo    renderer_info;
+    SDL_DisplayMode     display_mode;
+    bool                vsync = (SDL_GetRendererInfo(sdl2_internals.renderer, &renderer_info) == 0 && (renderer_info.flags & SDL_RENDERER_PRESENTVSYNC));
+    int                 refresh_rate = FALLBACK_REFRESH_RATE;
+
+    if(SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(sdl2_internals.window), &display_mode) == 0 && display_mode.refresh_rate > 0) {
+        refresh_rate = display_mode.refresh_rate;
+    }
+
+    std::chrono::duration<double>   refresh_period(1.0 / refresh_rate);
+    auto                            next_present = std::chrono::steady_clock::now();
+    std::thread                     emulation(emulation_loop);
+
+    while(!host_input.quit_requested) {
+        PROFILE_TIMED(event_listener, event_listener());
+        PROFILE_TIMED(screen_render, screen_render(sdl2_internals.renderer, sdl2_internals.texture));
         SDL_RenderPresent(sdl2_internals.renderer);
-    }         
+        if(!vsync) {
+            next_present = std::max(next_present + std::chrono::duration_cast<std::chrono::steady_clock::duration>(refresh_period),
+                std::chrono::steady_clock::now());
+            std::this_thread::sleep_until(next_present);
+        }
+    }
+    emulation.join();
+    std::cout << "Rewind history: " << rewind_buffer.entries.size() << " frames in " << rewind_buffer.bytes << " bytes.\n";
+    if(!machine.fault.empty()) {
+        std::cerr << machine.fault;
+        exit(1);
+    }
+#endif
 }
 
 
@@ -1,91 +1,2822 @@
 #include <iostream>
+#include <fstream>
 #include <cstring>
+#include <cstdlib>
 #include <chrono>
 #include <random>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <sstream>
+#include <map>
+#include <new>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <linux/perf_event.h>
+#include <linux/io_uring.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/*  Usage: memmove [--size BYTES --count N] [--threads N] [--sweep [--min-size BYTES] [--max-size BYTES] [--step FACTOR] [--budget SECONDS]]
+                   [--kernel NAME[,NAME...]|all] [--alloc NAME[,NAME...]|all] [--pin compact|scatter|CPULIST]
+                   [--numa local|interleave|cross|NODE] [--stride line|page|BYTES] [--chains N] [--counters]
+                   [--warmup N] [--repeat N] [--format text|csv|json] [--output FILE]
+       memmove --spsc [--pairs N] [--pair smt|core|socket] [--message BYTES] [--slots N] [--count N] [...]
+       memmove --file PATH [--io METHOD[,METHOD...]|all] [--block BYTES] [--depth N] [--hot] [--size BYTES] [...]
+       memmove --small [--sizes BYTES[,BYTES...]] [--misalign OFFSET[,OFFSET...]] [--kernel NAME[,NAME...]|all] [...]
+    Sizes take K/M/G suffixes. Without any flags it asks for the size, count and threads interactively like it always has.
+    --sweep steps the buffer size geometrically to map out the L1/L2/L3/DRAM bandwidth curve, calibrating the number of
+    transfers at every size so that each one takes roughly --budget seconds.
+    --kernel picks the copy loops to measure, see the kernels table below, memcpy by default. Bandwidth counts bytes read
+    plus bytes written like STREAM does, so a copy of N bytes moves 2N.
+    --pin fixes thread i to a CPU: compact fills CPUs in order, scatter round-robins across NUMA nodes, or give a list
+    like 0,2,8-11. --numa places the buffers through mbind: local binds them to the node the thread runs on, interleave
+    spreads pages over all nodes, cross puts the destination on the next node over from the source, a number binds
+    everything to that node. With either flag the results are also broken down per node and per CPU.
+    Every measurement is --warmup untimed passes followed by --repeat timed repetitions of COUNT transfers. All threads
+    leave a barrier together before each repetition, and the aggregate bandwidth of a repetition is the total traffic
+    over the common window from the first thread starting to the last one finishing. Times are reported as min, median,
+    p99 and standard deviation in nanoseconds, per thread and overall; bandwidths use the median.
+    --alloc picks how the buffers are allocated, see the allocators table, and with several of them every kernel is run
+    once per allocator so the rows sit side by side. Each row counts the page faults taken from allocation through the
+    last repetition, including those of the helper threads that fill the buffers, and those taken inside the timed
+    repetitions. huge2m and huge1g need pages reserved through
+    /proc/sys/vm/nr_hugepages or the hugepages-*kB sysfs entries, and are skipped when none are.
+    The chase kernel measures latency instead of bandwidth: the source buffer is turned into a random cyclic chain of
+    pointers, one per --stride bytes (line, page or a byte count), and each transfer follows it once round. With --chains
+    N the thread follows N independent chains in lockstep to expose memory-level parallelism. It reports nanoseconds per
+    dependent access and per load across all chains.
+    --counters opens perf_event_open counters in every thread for cycles, instructions, last level cache misses and dTLB
+    misses. They only count user space inside the timed repetitions. Where the uncore_imc PMUs exist, the memory
+    controller read and write traffic during the repetitions is reported as well. Counters the kernel or the hardware do
+    not provide (check /proc/sys/kernel/perf_event_paranoid) are reported empty and the run carries on.
+    --spsc measures handing data between cores instead: every pair of threads is a producer and a consumer joined by a
+    lock-free single-producer/single-consumer ring of --slots fixed-size messages. Each repetition streams --count
+    messages through the ring, followed by ping-pong round trips where the consumer echoes every message back on a second
+    ring. --pair places each consumer on an SMT sibling of its producer, another core of the same socket or another
+    socket, or give --pin with producer and consumer CPUs alternating. The rings follow --alloc and --numa, bound to the
+    producer's node. It reports messages and bytes per second over the common window, and round trip latency.
+    --file loads a test file into memory instead, every thread reading its own slice of it into a destination buffer
+    from --alloc. The methods are buffered read, pread in --block sized requests, mmap and copying out of the mapping,
+    pread on an O_DIRECT descriptor, and io_uring reads keeping --depth blocks in flight (driven through the raw
+    syscalls, no liburing). A missing file is created with --size bytes of generator data, an existing one is expected
+    to come from an earlier run since the loaded data is verified against the generator. The slices are dropped from
+    the page cache before every repetition unless --hot is given. Rows add the user plus system CPU time of the threads
+    during the repetitions; io_uring work punted to kernel workers is not included.
+    --small times short copies that stay in L1 instead, one matrix per copy kernel over --sizes and source and
+    destination --misalign offsets from a cache line. Timestamps come from rdtsc fenced with lfence and rdtscp, so the
+    figures are reference cycles per copy (nanoseconds on other architectures) for back to back copies through the
+    kernel's function pointer, with the cost of an empty call and the timestamps subtracted. Every matrix is repeated as
+    "fixed", a memcpy with the size known at compile time and inlined into the loop, for the power of two sizes, less
+    the cost of the same loop copying nothing. */
 
 static std::random_device hrng;
 static std::mutex lock_stdout;
-static bool canbegin = false;
 
-static int processor(int id, uint64_t size, uint64_t count) {
-    /*  workaround to prevent loop from being optimized out */
-    while(canbegin == false) {
-        std::cout << "";        
+/*  mempolicy modes, spelled out here so that libnuma is not needed */
+#define MEMPOLICY_BIND 2
+#define MEMPOLICY_INTERLEAVE 3
+#define NODEMASK_BITS 1024
+
+#define HUGE_PAGE_2M (2ull << 20)
+#define HUGE_PAGE_1G (1ull << 30)
+#define HUGE_SHIFT_2M 21
+#define HUGE_SHIFT_1G 30
+
+#define CACHE_LINE 64
+
+#define GENERATOR_GOLDEN 0x9E3779B97F4A7C15ull
+#define CHUNK_MIN (1ull << 20)
+#define MISMATCH_REPORT_MAX 8
+
+#define COUNTER_COUNT 4
+#define HW_CACHE_CONFIG(cache, op, result) ((cache) | ((op) << 8) | ((result) << 16))
+/*  every CAS command on the memory controller moves one cache line */
+#define IMC_BYTES_PER_COUNT 64
+#define CHASE_MAX_CHAINS 16
+
+/*  busy polls before a waiting ring side starts yielding, so oversubscribed pairs still make progress */
+#define SPIN_LIMIT 1024
+#define ROUND_TRIPS_MAX 100000
+#define SPSC_DEFAULT_COUNT (1ull << 20)
+
+/*  O_DIRECT wants offsets, lengths and buffers aligned to the logical block size, a page covers every common device */
+#define DIRECT_ALIGN 4096
+#define FILE_SEED 0x6D656D6D6F766521ull
+/*  an io_uring read length is 32 bits, larger blocks go out as several requests */
+#define URING_LENGTH_MAX (1ull << 30)
+
+#define SMALL_MAX 4096
+#define SMALL_SAMPLES 64
+#define SMALL_BATCH 32
+
+enum numa_mode {
+    NUMA_NONE,
+    NUMA_LOCAL,
+    NUMA_NODE,
+    NUMA_INTERLEAVE,
+    NUMA_CROSS
+};
+
+enum alloc_mode {
+    ALLOC_NEW,
+    ALLOC_ALIGNED,
+    ALLOC_MMAP,
+    ALLOC_POPULATE,
+    ALLOC_THP,
+    ALLOC_HUGETLB
+};
+
+struct allocator_struct {
+    const char* name;
+    alloc_mode mode;
+    /*  alignment of the buffer and granularity of the mapping, 0 for the base page */
+    uint64_t page;
+    /*  log2 of the page size passed through MAP_HUGE_SHIFT */
+    int huge_shift;
+};
+
+static const allocator_struct allocators[] = {
+    { "new", ALLOC_NEW, 0, 0 },
+    { "aligned", ALLOC_ALIGNED, HUGE_PAGE_2M, 0 },
+    { "mmap", ALLOC_MMAP, 0, 0 },
+    { "populate", ALLOC_POPULATE, 0, 0 },
+    { "thp", ALLOC_THP, HUGE_PAGE_2M, 0 },
+    { "huge2m", ALLOC_HUGETLB, HUGE_PAGE_2M, HUGE_SHIFT_2M },
+    { "huge1g", ALLOC_HUGETLB, HUGE_PAGE_1G, HUGE_SHIFT_1G }
+};
+
+enum counter_index {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_LLC_MISSES,
+    COUNTER_DTLB_MISSES
+};
+
+struct counter_struct {
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+};
+
+static const counter_struct counters[COUNTER_COUNT] = {
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "llc_misses", PERF_TYPE_HW_CACHE, HW_CACHE_CONFIG(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+    { "dtlb_misses", PERF_TYPE_HW_CACHE, HW_CACHE_CONFIG(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) }
+};
+
+struct options_struct {
+    std::string kernels = "memcpy";
+    std::string allocators = "new";
+    std::string pin;
+    numa_mode numa = NUMA_NONE;
+    int numa_node = 0;
+    uint64_t size = 0;
+    uint64_t count = 0;
+    uint64_t threads_count = 0;
+    bool sweep = false;
+    bool counters = false;
+    bool spsc = false;
+    std::string pair;
+    uint64_t pairs = 1;
+    uint64_t message = CACHE_LINE;
+    uint64_t slots = 256;
+    std::string file;
+    std::string io = "all";
+    uint64_t block = 1ull << 20;
+    uint64_t depth = 32;
+    bool hot = false;
+    bool small = false;
+    std::string sizes = "8,16,32,64,128,256,512,1K,2K,4K";
+    std::string misalign = "0,1,8,32";
+    uint64_t min_size = 1ull << 10;
+    uint64_t max_size = 4ull << 30;
+    double step = 2.0;
+    double budget = 0.5;
+    uint64_t stride = CACHE_LINE;
+    uint64_t chains = 1;
+    uint64_t warmup = 1;
+    uint64_t repeat = 5;
+    std::string format = "text";
+    const char* output_path = nullptr;
+};
+
+static options_struct options;
+
+/*  the CPUs we may run on and the NUMA node each of them belongs to, from sysfs */
+struct topology_struct {
+    std::vector<int> cpus;
+    std::map<int, int> cpu_node;
+    std::map<int, int> cpu_core;
+    std::map<int, int> cpu_package;
+    std::map<int, std::vector<int>> node_cpus;
+};
+
+static topology_struct topology;
+/*  CPU for every thread index, empty when threads are not pinned */
+static std::vector<int> placement;
+
+struct kernel_struct;
+
+struct result_struct {
+    const kernel_struct* kernel = nullptr;
+    const allocator_struct* allocator = nullptr;
+    int cpu = -1;
+    int node = -1;
+    uint64_t size = 0;
+    uint64_t count = 0;
+    /*  steady_clock nanoseconds at which every timed repetition started and ended */
+    std::vector<uint64_t> starts;
+    std::vector<uint64_t> ends;
+    /*  minor plus major faults from allocation through the last repetition, and inside the timed repetitions only */
+    uint64_t faults = 0;
+    uint64_t timed_faults = 0;
+    /*  user plus system time of the thread inside the timed repetitions, file mode only */
+    uint64_t cpu_ns = 0;
+    /*  -1 where a counter could not be opened or never got scheduled */
+    int64_t counts[COUNTER_COUNT] = { -1, -1, -1, -1 };
+    /*  memory controller traffic over the whole run, only filled in for the first thread */
+    int64_t memory_bytes = -1;
+    bool verified = false;
+};
+
+struct stats_struct {
+    uint64_t min = 0;
+    uint64_t median = 0;
+    uint64_t p99 = 0;
+    double stddev = 0;
+};
+
+/*  threads spin (yielding, so oversubscribed runs still make progress) until the last one arrives */
+struct barrier_struct {
+    uint64_t count = 0;
+    std::atomic<uint64_t> arrived{0};
+    std::atomic<uint64_t> generation{0};
+};
+
+/*  the last thread to arrive runs release, if given, before letting the others go */
+static void barrier_wait(barrier_struct& barrier, void (*release)(void) = nullptr) {
+    uint64_t generation = barrier.generation.load(std::memory_order_acquire);
+
+    if(barrier.arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == barrier.count) {
+        if(release != nullptr) {
+            release();
+        }
+        barrier.arrived.store(0, std::memory_order_relaxed);
+        barrier.generation.fetch_add(1, std::memory_order_release);
+        return;
+    }
+    while(barrier.generation.load(std::memory_order_acquire) == generation) {
+        std::this_thread::yield();
+    }
+}
+
+static uint64_t nanoseconds_now(void) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*  percentiles use the nearest rank, so with few repetitions p99 is simply the slowest one */
+static stats_struct stats_compute(std::vector<uint64_t> values) {
+    stats_struct stats;
+    double mean = 0;
+
+    if(values.empty()) {
+        return stats;
     }
-    bool isgood = true;
-    uint8_t* source =  new uint8_t[size];
-    uint8_t* destination = new uint8_t[size];
-    std::uniform_int_distribution<uint8_t> rand_uint8(0, UINT8_MAX);
-    std::mt19937 engine;
-    std::unique_lock<std::mutex> guard(lock_stdout, std::defer_lock);
-    uint64_t seed = hrng();
-    engine.seed(seed);
-    for (uint64_t i = 0; i < size; i++) {
-        source[i] = rand_uint8(engine);
-    }
-    auto start = std::chrono::system_clock::now();
-    for(uint64_t i = 0; i < count/2; i++) {
-        memset(destination, 0, sizeof(uint8_t) * size);
-        memcpy(destination, source, sizeof(uint8_t) * size);
-        memset(source, 0, sizeof(uint8_t) * size);
-        memcpy(source, destination, sizeof(uint8_t) * size);
-    }
-    auto end = std::chrono::system_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::milliseconds> (end - start);
-
-    guard.lock();
-    std::cout << "[Thread #" << id + 1 << "] Finished " << count << " transfers of " << sizeof(uint8_t)*size << " byte memory block in " << duration.count() << " milliseconds.\n";
-    if(duration.count() != 0) {
-        std::cout << "[Thread #" << id + 1 << "] Transfers per second: " << count*1000/duration.count() << ".\n"; 
-        std::cout << "[Thread #" << id + 1 << "] Memory bandwidth: " << count*1000*sizeof(uint8_t)*size/duration.count() << " bytes/second.\n";
-    }
-    std::cout << "[Thread #" << id + 1 << "] Verifying output...\n";
-    guard.unlock();
-    engine.seed(seed);
-    rand_uint8.reset();
-    for(uint64_t i = 0; i < size; i++) {
-        if(rand_uint8(engine) != destination[i]) {
-            guard.lock();
-            std::cout << "[Thread #" << id + 1 << "] Verify failed! Wrong value found at index " << i << ".\n";
-            guard.unlock();
-            isgood = false;
+    std::sort(values.begin(), values.end());
+    stats.min = values.front();
+    stats.median = values[(values.size() - 1) / 2];
+    stats.p99 = values[std::min(values.size() - 1, (size_t)std::ceil(values.size() * 0.99) - 1)];
+    for(uint64_t value : values) {
+        mean += (double)value / values.size();
+    }
+    for(uint64_t value : values) {
+        stats.stddev += (value - mean) * (value - mean) / values.size();
+    }
+    stats.stddev = std::sqrt(stats.stddev);
+    return stats;
+}
+
+static std::vector<uint64_t> durations_of(const result_struct& result) {
+    std::vector<uint64_t> durations;
+
+    for(size_t i = 0; i < result.starts.size(); i++) {
+        durations.push_back(result.ends[i] - result.starts[i]);
+    }
+    return durations;
+}
+
+static uint64_t bandwidth_over(uint64_t bytes, uint64_t nanoseconds) {
+    return (nanoseconds != 0) ? (uint64_t)((double)bytes * 1e9 / nanoseconds) : 0;
+}
+
+static bool verbose(void) {
+    return options.sweep == false && options.format == "text" && options.file.empty();
+}
+
+enum verify_kind {
+    VERIFY_NONE,
+    VERIFY_COPY,
+    VERIFY_WRITE,
+    VERIFY_SCALE,
+    VERIFY_TRIAD,
+    VERIFY_CHASE
+};
+
+/*  every kernel gets the same three buffers: destination is written, source and auxiliary are only read */
+typedef void (*kernel_function)(uint8_t* destination, const uint8_t* source, const uint8_t* auxiliary, uint64_t size);
+
+struct kernel_struct {
+    const char* name;
+    kernel_function function;
+    bool (*supported)(void);
+    /*  bytes of memory traffic per byte of buffer, reads plus writes */
+    uint64_t traffic;
+    verify_kind verify;
+    /*  the STREAM arithmetic kernels work on doubles, their inputs are kept finite */
+    bool floating;
+};
+
+#define STREAM_SCALAR 3.0
+#define STREAM_WRITE_PATTERN 0x5A5A5A5A5A5A5A5Aull
+
+static thread_local uint64_t read_sink = 0;
+
+static bool always_supported(void) {
+    return true;
+}
+
+static void kernel_memcpy(uint8_t* destination, const uint8_t* source, const uint8_t*, uint64_t size) {
+    memcpy(destination, source, size);
+}
+
+#if defined(__x86_64__)
+static void kernel_movsb(uint8_t* destination, const uint8_t* source, const uint8_t*, uint64_t size) {
+    asm volatile("rep movsb" : "+D"(destination), "+S"(source), "+c"(size) : : "memory");
+}
+
+/*  the vector kernels copy 64 bytes per iteration, the streaming variants first align the destination to a cache line
+    with a plain copy so that every non-temporal store is aligned, and fence once at the end */
+template<bool nontemporal>
+static void kernel_sse2(uint8_t* destination, const uint8_t* source, const uint8_t*, uint64_t size) {
+    uint64_t i = nontemporal ? std::min<uint64_t>(size, (0 - (uintptr_t)destination) & 63) : 0;
+
+    memcpy(destination, source, i);
+    for(; i + 64 <= size; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(source + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(source + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(source + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*)(source + i + 48));
+        if(nontemporal) {
+            _mm_stream_si128((__m128i*)(destination + i), a);
+            _mm_stream_si128((__m128i*)(destination + i + 16), b);
+            _mm_stream_si128((__m128i*)(destination + i + 32), c);
+            _mm_stream_si128((__m128i*)(destination + i + 48), d);
+        }
+        else {
+            _mm_storeu_si128((__m128i*)(destination + i), a);
+            _mm_storeu_si128((__m128i*)(destination + i + 16), b);
+            _mm_storeu_si128((__m128i*)(destination + i + 32), c);
+            _mm_storeu_si128((__m128i*)(destination + i + 48), d);
         }
     }
-    delete[] source;
-    delete[] destination;
-    if(isgood == true) {
-        guard.lock();
-        std::cout << "[Thread #" << id + 1 << "] Output OK.\n";
-        guard.unlock();
-        return 0;
+    memcpy(destination + i, source + i, size - i);
+    if(nontemporal) {
+        _mm_sfence();
     }
-    return 1;
 }
 
-int main(void) {
-    uint64_t size = 0;
-    uint64_t count = 0;
-    uint64_t threads_count = 0;
+template<bool nontemporal>
+__attribute__((target("avx2")))
+static void kernel_avx2(uint8_t* destination, const uint8_t* source, const uint8_t*, uint64_t size) {
+    uint64_t i = nontemporal ? std::min<uint64_t>(size, (0 - (uintptr_t)destination) & 63) : 0;
+
+    memcpy(destination, source, i);
+    for(; i + 64 <= size; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(source + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(source + i + 32));
+        if(nontemporal) {
+            _mm256_stream_si256((__m256i*)(destination + i), a);
+            _mm256_stream_si256((__m256i*)(destination + i + 32), b);
+        }
+        else {
+            _mm256_storeu_si256((__m256i*)(destination + i), a);
+            _mm256_storeu_si256((__m256i*)(destination + i + 32), b);
+        }
+    }
+    memcpy(destination + i, source + i, size - i);
+    if(nontemporal) {
+        _mm_sfence();
+    }
+}
 
-    std::cout << "Memory area size (in bytes)? ";
-    std::cin >> size;
-    std::cout << "Number of transfers? ";
-    std::cin >> count;
-    std::cout << "Threads to be spawned? ";
-    std::cin >> threads_count;
+template<bool nontemporal>
+__attribute__((target("avx512f")))
+static void kernel_avx512(uint8_t* destination, const uint8_t* source, const uint8_t*, uint64_t size) {
+    uint64_t i = nontemporal ? std::min<uint64_t>(size, (0 - (uintptr_t)destination) & 63) : 0;
 
-    std::vector<std::thread> thread_array(threads_count);
-    for(uint64_t i = 0; i < threads_count; i++) {
-        std::cout << "Spawned thread #" << i + 1 << "\n";
-        thread_array.at(i) = std::thread(processor, i, size, count);
+    memcpy(destination, source, i);
+    for(; i + 64 <= size; i += 64) {
+        __m512i a = _mm512_loadu_si512((const void*)(source + i));
+        if(nontemporal) {
+            _mm512_stream_si512((__m512i*)(destination + i), a);
+        }
+        else {
+            _mm512_storeu_si512((void*)(destination + i), a);
+        }
     }
-    canbegin = true;
-    for(uint64_t i = 0; i < threads_count; i++) {
-        thread_array.at(i).join();
+    memcpy(destination + i, source + i, size - i);
+    if(nontemporal) {
+        _mm_sfence();
+    }
+}
+
+static bool avx2_supported(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+static bool avx512_supported(void) {
+    return __builtin_cpu_supports("avx512f");
+}
+#endif
+
+/*  STREAM style loops, kept as plain loops so the compiler does not turn them back into memcpy/memset calls */
+__attribute__((optimize("no-tree-loop-distribute-patterns")))
+static void kernel_stream_read(uint8_t*, const uint8_t* source, const uint8_t*, uint64_t size) {
+    const uint64_t* a = (const uint64_t*)source;
+    uint64_t sum = 0;
+
+    for(uint64_t i = 0; i < size / sizeof(uint64_t); i++) {
+        sum += a[i];
+    }
+    read_sink += sum;
+}
+
+__attribute__((optimize("no-tree-loop-distribute-patterns")))
+static void kernel_stream_write(uint8_t* destination, const uint8_t*, const uint8_t*, uint64_t size) {
+    uint64_t* a = (uint64_t*)destination;
+
+    for(uint64_t i = 0; i < size / sizeof(uint64_t); i++) {
+        a[i] = STREAM_WRITE_PATTERN;
+    }
+}
+
+__attribute__((optimize("no-tree-loop-distribute-patterns")))
+static void kernel_stream_copy(uint8_t* destination, const uint8_t* source, const uint8_t*, uint64_t size) {
+    double* c = (double*)destination;
+    const double* a = (const double*)source;
+
+    for(uint64_t i = 0; i < size / sizeof(double); i++) {
+        c[i] = a[i];
+    }
+    memcpy(destination + size / sizeof(double) * sizeof(double), source + size / sizeof(double) * sizeof(double), size % sizeof(double));
+}
+
+__attribute__((optimize("no-tree-loop-distribute-patterns")))
+static void kernel_stream_scale(uint8_t* destination, const uint8_t* source, const uint8_t*, uint64_t size) {
+    double* b = (double*)destination;
+    const double* c = (const double*)source;
+
+    for(uint64_t i = 0; i < size / sizeof(double); i++) {
+        b[i] = STREAM_SCALAR * c[i];
+    }
+}
+
+__attribute__((optimize("no-tree-loop-distribute-patterns")))
+static void kernel_stream_triad(uint8_t* destination, const uint8_t* source, const uint8_t* auxiliary, uint64_t size) {
+    double* a = (double*)destination;
+    const double* b = (const double*)auxiliary;
+    const double* c = (const double*)source;
+
+    for(uint64_t i = 0; i < size / sizeof(double); i++) {
+        a[i] = b[i] + STREAM_SCALAR * c[i];
+    }
+}
+
+/*  the chain has one node every stride bytes, nodes further apart than a line also move along by a line each time so that
+    they do not all land in the same cache set. The first word of a node points to the next one */
+static uint64_t chase_nodes(uint64_t size) {
+    return size / options.stride;
+}
+
+static uint8_t* chase_node(const uint8_t* source, uint64_t i) {
+    return (uint8_t*)source + i * options.stride + (options.stride > CACHE_LINE ? (i * CACHE_LINE) % options.stride : 0);
+}
+
+/*  Sattolo's shuffle gives a permutation with a single cycle, so every chain visits every node. It is shuffled in place
+    through the node slots as indices, then the indices are turned into pointers. The chains start spread evenly along
+    the cycle, walked from the first node, so no chain trails another closely enough to find its lines still cached.
+    Their cursors live in the destination and carry over from one transfer to the next */
+static void chase_build(uint8_t* source, uint8_t* destination, uint64_t size, uint64_t seed) {
+    uint64_t nodes = chase_nodes(size);
+    std::mt19937_64 engine(seed);
+
+    for(uint64_t i = 0; i < nodes; i++) {
+        *(uint64_t*)chase_node(source, i) = i;
+    }
+    for(uint64_t i = nodes - 1; i > 0; i--) {
+        uint64_t j = std::uniform_int_distribution<uint64_t>(0, i - 1)(engine);
+        std::swap(*(uint64_t*)chase_node(source, i), *(uint64_t*)chase_node(source, j));
+    }
+    for(uint64_t i = 0; i < nodes; i++) {
+        *(uint8_t**)chase_node(source, i) = chase_node(source, *(uint64_t*)chase_node(source, i));
+    }
+    uint8_t* node = chase_node(source, 0);
+    for(uint64_t i = 0, c = 0; i < nodes && c < options.chains; i++) {
+        if(i == c * nodes / options.chains) {
+            ((uint8_t**)destination)[c++] = node;
+        }
+        node = *(uint8_t**)node;
+    }
+}
+
+/*  walks the chain once from the first node, it has to come back exactly after visiting every node */
+static bool chase_verify(const uint8_t* source, uint64_t size) {
+    uint64_t nodes = chase_nodes(size);
+    uint8_t* start = chase_node(source, 0);
+    uint8_t* node = start;
+
+    for(uint64_t i = 1; i <= nodes; i++) {
+        node = *(uint8_t**)node;
+        if(node < source || node >= source + size || (node == start) != (i == nodes)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template<int chains>
+static void chase(uint8_t** cursors, uint64_t steps) {
+    uint8_t* node[chains];
+
+    for(int c = 0; c < chains; c++) {
+        node[c] = cursors[c];
+    }
+    for(uint64_t i = 0; i < steps; i++) {
+        for(int c = 0; c < chains; c++) {
+            node[c] = *(uint8_t**)node[c];
+        }
+    }
+    for(int c = 0; c < chains; c++) {
+        cursors[c] = node[c];
+    }
+}
+
+static void (*const chasers[CHASE_MAX_CHAINS])(uint8_t**, uint64_t) = {
+    chase<1>, chase<2>, chase<3>, chase<4>, chase<5>, chase<6>, chase<7>, chase<8>,
+    chase<9>, chase<10>, chase<11>, chase<12>, chase<13>, chase<14>, chase<15>, chase<16>
+};
+
+static void kernel_chase(uint8_t* destination, const uint8_t*, const uint8_t*, uint64_t size) {
+    chasers[options.chains - 1]((uint8_t**)destination, chase_nodes(size));
+}
+
+static const kernel_struct kernels[] = {
+    { "memcpy", kernel_memcpy, always_supported, 2, VERIFY_COPY, false },
+#if defined(__x86_64__)
+    { "movsb", kernel_movsb, always_supported, 2, VERIFY_COPY, false },
+    { "sse2", kernel_sse2<false>, always_supported, 2, VERIFY_COPY, false },
+    { "sse2_nt", kernel_sse2<true>, always_supported, 2, VERIFY_COPY, false },
+    { "avx2", kernel_avx2<false>, avx2_supported, 2, VERIFY_COPY, false },
+    { "avx2_nt", kernel_avx2<true>, avx2_supported, 2, VERIFY_COPY, false },
+    { "avx512", kernel_avx512<false>, avx512_supported, 2, VERIFY_COPY, false },
+    { "avx512_nt", kernel_avx512<true>, avx512_supported, 2, VERIFY_COPY, false },
+#endif
+    { "read", kernel_stream_read, always_supported, 1, VERIFY_NONE, false },
+    { "write", kernel_stream_write, always_supported, 1, VERIFY_WRITE, false },
+    { "copy", kernel_stream_copy, always_supported, 2, VERIFY_COPY, false },
+    { "scale", kernel_stream_scale, always_supported, 2, VERIFY_SCALE, true },
+    { "triad", kernel_stream_triad, always_supported, 3, VERIFY_TRIAD, true },
+    { "chase", kernel_chase, always_supported, 0, VERIFY_CHASE, false }
+};
+
+/*  the timed loop */
+static void transfer(const kernel_struct* kernel, uint8_t* source, uint8_t* destination, uint8_t* auxiliary, uint64_t size, uint64_t count) {
+    for(uint64_t i = 0; i < count; i++) {
+        kernel->function(destination, source, auxiliary, size);
+    }
+}
+
+/*  splitmix64 over the word index, so any word of the data can be regenerated on its own and the buffers can be filled
+    and checked in independent chunks. The source and auxiliary buffers use different seeds */
+static uint64_t generator_word(uint64_t seed, uint64_t index) {
+    uint64_t z = seed + (index + 1) * GENERATOR_GOLDEN;
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/*  floating clears the top exponent bit of every word so the arithmetic kernels never see an infinity or a NaN. begin
+    is word aligned, the last word is cut short when end is not */
+static void generator_fill(uint8_t* buffer, uint64_t begin, uint64_t end, uint64_t seed, bool floating) {
+    uint64_t mask = floating ? ~(1ull << 62) : ~0ull;
+    uint64_t words = (end - begin) / sizeof(uint64_t);
+    uint64_t* destination = (uint64_t*)(buffer + begin);
+    uint64_t first = begin / sizeof(uint64_t);
+
+    for(uint64_t i = 0; i < words; i++) {
+        destination[i] = generator_word(seed, first + i) & mask;
+    }
+    if(begin + words * sizeof(uint64_t) < end) {
+        uint64_t word = generator_word(seed, first + words) & mask;
+        memcpy(destination + words, &word, end - begin - words * sizeof(uint64_t));
+    }
+}
+
+static bool close_enough(double value, double expected) {
+    return std::fabs(value - expected) <= 1e-12 * std::fabs(expected);
+}
+
+/*  whether the word of the destination at offset holds what the kernel should have left there. Copies are checked against
+    the generator, the last word only as far as the buffer goes; the arithmetic kernels only write whole words */
+static bool verify_word(const kernel_struct* kernel, const uint8_t* source, const uint8_t* destination, const uint8_t* auxiliary, uint64_t size, uint64_t seed, uint64_t offset) {
+    uint64_t length = std::min<uint64_t>(sizeof(uint64_t), size - offset);
+    uint64_t word = 0;
+    double a;
+    double b;
+    double c;
+
+    if(kernel->verify == VERIFY_COPY) {
+        word = generator_word(seed, offset / sizeof(uint64_t));
+        return memcmp(destination + offset, &word, length) == 0;
+    }
+    if(length < sizeof(uint64_t)) {
+        return true;
+    }
+    memcpy(&word, destination + offset, sizeof(word));
+    memcpy(&a, destination + offset, sizeof(a));
+    memcpy(&b, auxiliary + offset, sizeof(b));
+    memcpy(&c, source + offset, sizeof(c));
+    return (kernel->verify == VERIFY_WRITE && word == STREAM_WRITE_PATTERN) ||
+           (kernel->verify == VERIFY_SCALE && close_enough(a, STREAM_SCALAR * c)) ||
+           (kernel->verify == VERIFY_TRIAD && close_enough(a, b + STREAM_SCALAR * c));
+}
+
+/*  byte ranges [first, second) of the destination that are wrong, adjacent bad words merged into one range */
+typedef std::vector<std::pair<uint64_t, uint64_t>> mismatch_list;
+
+static void verify_chunk(const kernel_struct* kernel, const uint8_t* source, const uint8_t* destination, const uint8_t* auxiliary, uint64_t size, uint64_t seed,
+                         uint64_t begin, uint64_t end, mismatch_list* mismatches) {
+    for(uint64_t offset = begin; offset < end; offset += sizeof(uint64_t)) {
+        if(verify_word(kernel, source, destination, auxiliary, size, seed, offset)) {
+            continue;
+        }
+        uint64_t bad_end = std::min(offset + sizeof(uint64_t), size);
+        if(!mismatches->empty() && mismatches->back().second == offset) {
+            mismatches->back().second = bad_end;
+        }
+        else {
+            mismatches->emplace_back(offset, bad_end);
+        }
+    }
+}
+
+/*  helpers for filling and checking one thread's buffers, the CPUs left over by the benchmark threads. Helper threads
+    inherit the caller's affinity, so a pinned thread does the work itself and first touch stays on its node */
+static uint64_t chunk_helpers(void) {
+    cpu_set_t allowed;
+
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    uint64_t spare = std::max<uint64_t>(1, std::thread::hardware_concurrency() / options.threads_count);
+    return std::min<uint64_t>(spare, CPU_COUNT(&allowed));
+}
+
+static uint64_t page_faults(void) {
+    struct rusage usage;
+
+    getrusage(RUSAGE_THREAD, &usage);
+    return usage.ru_minflt + usage.ru_majflt;
+}
+
+/*  splits [0, size) into word aligned chunks of at least CHUNK_MIN bytes and runs work(index, begin, end) on each of them
+    across the helpers. The chunk rounds the share up so that the last chunk ends exactly at size. Returns the page
+    faults the helper threads took, those of the calling thread show up in its own counts already */
+template<typename function>
+static uint64_t parallel_chunks(uint64_t size, function work) {
+    uint64_t helpers = std::min(chunk_helpers(), std::max<uint64_t>(1, size / CHUNK_MIN));
+    uint64_t chunk = ((size + helpers - 1) / helpers + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+    std::vector<std::thread> threads;
+    std::vector<uint64_t> faults(helpers, 0);
+
+    for(uint64_t i = 1; i < helpers; i++) {
+        threads.emplace_back([&, i]() {
+            uint64_t before = page_faults();
+            work(i, std::min(size, i * chunk), std::min(size, (i + 1) * chunk));
+            faults[i] = page_faults() - before;
+        });
+    }
+    work(0, 0, std::min(size, chunk));
+    for(std::thread& thread : threads) {
+        thread.join();
+    }
+    return std::accumulate(faults.begin(), faults.end(), (uint64_t)0);
+}
+
+static mismatch_list verify_parallel(const kernel_struct* kernel, const uint8_t* source, const uint8_t* destination, const uint8_t* auxiliary, uint64_t size, uint64_t seed) {
+    std::vector<mismatch_list> chunks(chunk_helpers());
+    mismatch_list mismatches;
+
+    parallel_chunks(size, [&](uint64_t index, uint64_t begin, uint64_t end) {
+        verify_chunk(kernel, source, destination, auxiliary, size, seed, begin, end, &chunks[index]);
+    });
+    for(const mismatch_list& chunk : chunks) {
+        for(const auto& range : chunk) {
+            if(!mismatches.empty() && mismatches.back().second == range.first) {
+                mismatches.back().second = range.second;
+            }
+            else {
+                mismatches.push_back(range);
+            }
+        }
+    }
+    return mismatches;
+}
+
+/*  parses lists like "0-3,8,10-11" as used by sysfs and taskset */
+static std::vector<int> parse_cpu_list(const std::string& text) {
+    std::vector<int> list;
+    std::stringstream stream(text);
+    std::string range;
+
+    while(std::getline(stream, range, ',')) {
+        size_t dash = range.find('-');
+        if(range.empty() || range[0] == '\n') {
+            continue;
+        }
+        int first = std::stoi(range.substr(0, dash));
+        int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+        for(int cpu = first; cpu <= last; cpu++) {
+            list.push_back(cpu);
+        }
+    }
+    return list;
+}
+
+static void topology_discover(void) {
+    cpu_set_t allowed;
+
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if(CPU_ISSET(cpu, &allowed)) {
+            std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+            std::ifstream core(path + "core_id");
+            std::ifstream package(path + "physical_package_id");
+            topology.cpus.push_back(cpu);
+            topology.cpu_node[cpu] = 0;
+            topology.cpu_core[cpu] = cpu;
+            topology.cpu_package[cpu] = 0;
+            core >> topology.cpu_core[cpu];
+            package >> topology.cpu_package[cpu];
+        }
     }
-    std::cout << "Complete!\n";
-    return 0;   
+    for(int node = 0; node < NODEMASK_BITS; node++) {
+        std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string text;
+        if(!cpulist || !std::getline(cpulist, text)) {
+            continue;
+        }
+        for(int cpu : parse_cpu_list(text)) {
+            if(CPU_ISSET(cpu, &allowed)) {
+                topology.cpu_node[cpu] = node;
+                topology.node_cpus[node].push_back(cpu);
+            }
+        }
+    }
+    /*  no sysfs node information, treat the machine as one node */
+    if(topology.node_cpus.empty()) {
+        topology.node_cpus[0] = topology.cpus;
+    }
+}
+
+static bool pair_related(int producer, int consumer) {
+    bool same_package = topology.cpu_package[producer] == topology.cpu_package[consumer];
+    bool same_core = same_package && topology.cpu_core[producer] == topology.cpu_core[consumer];
+
+    if(options.pair == "smt") {
+        return same_core;
+    }
+    if(options.pair == "core") {
+        return same_package && !same_core;
+    }
+    return !same_package;
+}
+
+/*  every producer takes the next free CPU and its consumer the first free CPU in the wanted relation to it, or any free
+    one when there is none. Once the CPUs run out they are handed out again */
+static void pair_placement(void) {
+    std::vector<int> free;
+
+    for(uint64_t i = 0; i < options.pairs; i++) {
+        if(free.empty()) {
+            free = topology.cpus;
+        }
+        int producer = free.front();
+        free.erase(free.begin());
+        auto consumer = std::find_if(free.begin(), free.end(), [producer](int cpu) { return pair_related(producer, cpu); });
+        if(consumer == free.end()) {
+            std::cerr << "No free CPU is a " << options.pair << " neighbour of CPU " << producer << ", pair " << i + 1 << " is placed anywhere.\n";
+            consumer = free.begin();
+        }
+        placement.push_back(producer);
+        placement.push_back(consumer == free.end() ? producer : *consumer);
+        if(consumer != free.end()) {
+            free.erase(consumer);
+        }
+    }
+}
+
+/*  compact walks the CPUs in order, scatter takes one CPU from each node in turn */
+static void placement_compute(void) {
+    std::vector<int> order;
+
+    if(options.spsc && options.pin.empty() && !options.pair.empty()) {
+        pair_placement();
+        return;
+    }
+    if(options.pin.empty()) {
+        return;
+    }
+    if(options.pin == "compact") {
+        order = topology.cpus;
+    }
+    else if(options.pin == "scatter") {
+        for(size_t rank = 0; order.size() < topology.cpus.size(); rank++) {
+            for(const auto& node : topology.node_cpus) {
+                if(rank < node.second.size()) {
+                    order.push_back(node.second[rank]);
+                }
+            }
+        }
+    }
+    else {
+        order = parse_cpu_list(options.pin);
+    }
+    if(order.empty()) {
+        std::cerr << "No CPUs to pin to for --pin " << options.pin << ".\n";
+        exit(1);
+    }
+    for(uint64_t i = 0; i < options.threads_count; i++) {
+        placement.push_back(order[i % order.size()]);
+    }
+}
+
+static int node_of(int cpu) {
+    auto found = topology.cpu_node.find(cpu);
+    return (found == topology.cpu_node.end()) ? 0 : found->second;
+}
+
+/*  the node after this one, wrapping around, for the cross-node mode */
+static int node_next(int node) {
+    auto found = topology.node_cpus.upper_bound(node);
+    return (found == topology.node_cpus.end()) ? topology.node_cpus.begin()->first : found->first;
+}
+
+static int perf_open(uint32_t type, uint64_t config, int pid, int cpu) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    /*  per-thread counters only look at user space, which is also all that perf_event_paranoid 2 allows. The system wide
+        uncore events get no exclude bits at all, the uncore PMUs reject any of them */
+    attr.exclude_kernel = (pid == 0);
+    attr.exclude_hv = (pid == 0);
+    return syscall(SYS_perf_event_open, &attr, pid, cpu, -1, 0);
+}
+
+/*  the value scaled up for the time the kernel had to multiplex the counter out, -1 if it never ran */
+static int64_t perf_read(int descriptor) {
+    uint64_t values[3];
+
+    if(descriptor < 0 || read(descriptor, values, sizeof(values)) != sizeof(values) || values[2] == 0) {
+        return -1;
+    }
+    return (int64_t)((double)values[0] * values[1] / values[2]);
+}
+
+static void counters_open(int* descriptors) {
+    static std::once_flag warn_once[COUNTER_COUNT];
+
+    for(int i = 0; i < COUNTER_COUNT; i++) {
+        descriptors[i] = perf_open(counters[i].type, counters[i].config, 0, -1);
+        if(descriptors[i] < 0) {
+            std::call_once(warn_once[i], [i] { std::cerr << "Counter " << counters[i].name << " is unavailable: " << strerror(errno) << ".\n"; });
+        }
+    }
+}
+
+static void counters_close(int* descriptors, int64_t* counts) {
+    for(int i = 0; i < COUNTER_COUNT; i++) {
+        counts[i] = perf_read(descriptors[i]);
+        if(descriptors[i] >= 0) {
+            close(descriptors[i]);
+        }
+    }
+}
+
+/*  uncore memory controller counters, one read and one write CAS counter per channel opened on the CPU sysfs names for
+    it. They count system wide, which needs perf_event_paranoid 0 or CAP_PERFMON */
+static std::vector<int> imc_descriptors;
+
+static bool imc_event(const std::string& path, uint64_t* config) {
+    std::ifstream file(path);
+    std::string text;
+    unsigned event = 0;
+    unsigned umask = 0;
+
+    if(!file || !std::getline(file, text) || sscanf(text.c_str(), "event=%x,umask=%x", &event, &umask) != 2) {
+        return false;
+    }
+    /*  the Intel uncore format puts the event in config:0-7 and the umask in config:8-15 */
+    *config = event | (umask << 8);
+    return true;
+}
+
+static void imc_open(void) {
+    const char* root = "/sys/bus/event_source/devices/";
+    const char* events[] = { "cas_count_read", "cas_count_write" };
+    DIR* devices = opendir(root);
+
+    if(devices == nullptr) {
+        return;
+    }
+    while(struct dirent* entry = readdir(devices)) {
+        std::string pmu = std::string(root) + entry->d_name + "/";
+        std::ifstream type_file(pmu + "type");
+        std::ifstream cpumask_file(pmu + "cpumask");
+        std::string cpumask;
+        uint32_t type = 0;
+
+        if(strncmp(entry->d_name, "uncore_imc", 10) != 0 || !(type_file >> type) || !std::getline(cpumask_file, cpumask)) {
+            continue;
+        }
+        for(int cpu : parse_cpu_list(cpumask)) {
+            for(const char* event : events) {
+                uint64_t config = 0;
+                int descriptor = imc_event(pmu + "events/" + event, &config) ? perf_open(type, config, -1, cpu) : -1;
+                if(descriptor < 0) {
+                    std::cerr << "Memory controller counter " << entry->d_name << "/" << event << " is unavailable: " << strerror(errno) << ".\n";
+                    continue;
+                }
+                imc_descriptors.push_back(descriptor);
+            }
+        }
+    }
+    closedir(devices);
 }
 
+static void imc_control(unsigned long request) {
+    for(int descriptor : imc_descriptors) {
+        ioctl(descriptor, request, 0);
+    }
+}
+
+static void imc_enable(void) {
+    imc_control(PERF_EVENT_IOC_ENABLE);
+}
+
+static void imc_disable(void) {
+    imc_control(PERF_EVENT_IOC_DISABLE);
+}
+
+static int64_t imc_bytes(void) {
+    int64_t total = 0;
+
+    if(imc_descriptors.empty()) {
+        return -1;
+    }
+    for(int descriptor : imc_descriptors) {
+        int64_t count = perf_read(descriptor);
+        if(count < 0) {
+            return -1;
+        }
+        total += count * IMC_BYTES_PER_COUNT;
+    }
+    return total;
+}
+
+struct buffer_struct {
+    uint8_t* data = nullptr;
+    const allocator_struct* allocator = nullptr;
+    /*  non-zero when the buffer was mapped, either for the allocator or so that a memory policy could be applied before
+        the first touch */
+    uint64_t mapped = 0;
+};
+
+static int mmap_flags(const allocator_struct* allocator) {
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    if(allocator->mode == ALLOC_HUGETLB) {
+        flags |= MAP_HUGETLB | (allocator->huge_shift << MAP_HUGE_SHIFT);
+    }
+    if(allocator->mode == ALLOC_POPULATE && options.numa == NUMA_NONE) {
+        flags |= MAP_POPULATE;
+    }
+    return flags;
+}
+
+/*  hugetlb mappings fail outright when no pages of that size are reserved */
+static bool allocator_supported(const allocator_struct* allocator) {
+    if(allocator->mode != ALLOC_HUGETLB) {
+        return true;
+    }
+    void* probe = mmap(nullptr, allocator->page, PROT_READ | PROT_WRITE, mmap_flags(allocator), -1, 0);
+    if(probe == MAP_FAILED) {
+        return false;
+    }
+    munmap(probe, allocator->page);
+    return true;
+}
+
+/*  maps length bytes aligned to alignment by over-mapping and trimming both ends */
+static uint8_t* mmap_aligned(uint64_t length, uint64_t alignment, int flags) {
+    uint8_t* base = (uint8_t*)mmap(nullptr, length + alignment, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if(base == MAP_FAILED) {
+        return (uint8_t*)MAP_FAILED;
+    }
+    uint8_t* aligned = (uint8_t*)(((uintptr_t)base + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    if(aligned != base) {
+        munmap(base, aligned - base);
+    }
+    munmap(aligned + length, base + alignment - aligned);
+    return aligned;
+}
+
+/*  node < 0 leaves placement to first touch, otherwise pages are bound to the node, or interleaved over all of them */
+static buffer_struct buffer_allocate(uint64_t size, int node, const allocator_struct* allocator) {
+    static std::once_flag warn_once;
+    static std::once_flag warn_hugetlb;
+    static std::once_flag warn_thp;
+    uint64_t base_page = sysconf(_SC_PAGESIZE);
+    buffer_struct buffer;
+
+    buffer.allocator = allocator;
+    if(allocator->mode == ALLOC_NEW && options.numa == NUMA_NONE) {
+        buffer.data = new uint8_t[size];
+        return buffer;
+    }
+    if(allocator->mode == ALLOC_ALIGNED && options.numa == NUMA_NONE) {
+        buffer.data = (uint8_t*)operator new[](size, std::align_val_t(allocator->page));
+        return buffer;
+    }
+    uint64_t page = (allocator->mode == ALLOC_HUGETLB) ? allocator->page : base_page;
+    buffer.mapped = (std::max<uint64_t>(size, 1) + page - 1) / page * page;
+    if(allocator->page != 0 && allocator->mode != ALLOC_HUGETLB) {
+        buffer.data = mmap_aligned(buffer.mapped, allocator->page, mmap_flags(allocator));
+    }
+    else {
+        buffer.data = (uint8_t*)mmap(nullptr, buffer.mapped, PROT_READ | PROT_WRITE, mmap_flags(allocator), -1, 0);
+    }
+    /*  the reserved pool can run out at large sizes even though the probe succeeded */
+    if(buffer.data == MAP_FAILED && allocator->mode == ALLOC_HUGETLB) {
+        std::call_once(warn_hugetlb, [allocator] { std::cerr << "Not enough " << allocator->name << " pages reserved, falling back to base pages.\n"; });
+        buffer.mapped = (std::max<uint64_t>(size, 1) + base_page - 1) / base_page * base_page;
+        buffer.data = (uint8_t*)mmap(nullptr, buffer.mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if(buffer.data == MAP_FAILED) {
+        std::cerr << "mmap of " << size << " bytes failed: " << strerror(errno) << ".\n";
+        exit(1);
+    }
+    if(allocator->mode == ALLOC_THP && madvise(buffer.data, buffer.mapped, MADV_HUGEPAGE) != 0) {
+        std::call_once(warn_thp, [] { std::cerr << "madvise(MADV_HUGEPAGE) failed (" << strerror(errno) << "), transparent huge pages are probably disabled.\n"; });
+    }
+    if(options.numa == NUMA_NONE) {
+        return buffer;
+    }
+
+    unsigned long nodemask[NODEMASK_BITS / (8 * sizeof(unsigned long))] = { };
+    int mode = MEMPOLICY_BIND;
+    if(options.numa == NUMA_INTERLEAVE) {
+        mode = MEMPOLICY_INTERLEAVE;
+        for(const auto& entry : topology.node_cpus) {
+            nodemask[entry.first / (8 * sizeof(unsigned long))] |= 1ul << (entry.first % (8 * sizeof(unsigned long)));
+        }
+    }
+    else {
+        nodemask[node / (8 * sizeof(unsigned long))] |= 1ul << (node % (8 * sizeof(unsigned long)));
+    }
+    /*  the kernel reads one bit less than maxnode says */
+    if(syscall(SYS_mbind, buffer.data, buffer.mapped, mode, nodemask, NODEMASK_BITS + 1, 0) != 0) {
+        std::call_once(warn_once, [] { std::cerr << "mbind failed (" << strerror(errno) << "), buffers fall back to first touch placement.\n"; });
+    }
+    /*  MAP_POPULATE would fault the pages in before the policy is set, so prefault by hand afterwards */
+    if(allocator->mode == ALLOC_POPULATE) {
+        for(uint64_t i = 0; i < buffer.mapped; i += base_page) {
+            buffer.data[i] = 0;
+        }
+    }
+    return buffer;
+}
+
+static void buffer_free(buffer_struct& buffer) {
+    if(buffer.mapped != 0) {
+        munmap(buffer.data, buffer.mapped);
+    }
+    else if(buffer.allocator->mode == ALLOC_ALIGNED) {
+        operator delete[](buffer.data, std::align_val_t(buffer.allocator->page));
+    }
+    else {
+        delete[] buffer.data;
+    }
+    buffer.data = nullptr;
+}
+
+/*  nanoseconds per step of one chain, a full round of every chain per transfer */
+static double chase_latency(uint64_t nanoseconds, uint64_t count, uint64_t size) {
+    return (double)nanoseconds / (count * chase_nodes(size));
+}
+
+/*  chains need at least two nodes and room for their cursors in the destination */
+static bool chase_fits(uint64_t size) {
+    return chase_nodes(size) >= 2 && size >= options.chains * sizeof(uint8_t*);
+}
+
+/*  pins the calling thread to its CPU from the placement, returns the CPU it ends up on */
+static int pin_thread(int id) {
+    if(!placement.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(placement.at(id), &set);
+        if(sched_setaffinity(0, sizeof(set), &set) != 0) {
+            std::cerr << "[Thread #" << id + 1 << "] Could not pin to CPU " << placement.at(id) << ": " << strerror(errno) << ".\n";
+        }
+    }
+    return sched_getcpu();
+}
+
+static int processor(int id, const kernel_struct* kernel, const allocator_struct* allocator, uint64_t size, uint64_t count, barrier_struct* barrier, result_struct* result) {
+    /*  pin before allocating so that first touch already happens on the right node */
+    result->cpu = pin_thread(id);
+    result->node = node_of(result->cpu);
+
+    int source_node = (options.numa == NUMA_NODE) ? options.numa_node : result->node;
+    int destination_node = (options.numa == NUMA_CROSS) ? node_next(source_node) : source_node;
+    uint64_t faults = page_faults();
+    buffer_struct source_buffer = buffer_allocate(size, source_node, allocator);
+    buffer_struct destination_buffer = buffer_allocate(size, destination_node, allocator);
+    buffer_struct auxiliary_buffer = buffer_allocate(size, source_node, allocator);
+    bool isgood = true;
+    uint8_t* source = source_buffer.data;
+    uint8_t* destination = destination_buffer.data;
+    uint8_t* auxiliary = auxiliary_buffer.data;
+    std::unique_lock<std::mutex> guard(lock_stdout, std::defer_lock);
+    uint64_t seed = ((uint64_t)hrng() << 32) | hrng();
+    uint64_t auxiliary_seed = generator_word(seed, UINT64_MAX);
+    /*  the helpers take the first touch faults of the buffers, they count towards this thread */
+    uint64_t helper_faults = parallel_chunks(size, [&](uint64_t, uint64_t begin, uint64_t end) {
+        generator_fill(source, begin, end, seed, kernel->floating);
+        generator_fill(auxiliary, begin, end, auxiliary_seed, kernel->floating);
+    });
+    if(kernel->verify == VERIFY_CHASE) {
+        chase_build(source, destination, size, seed);
+    }
+    int descriptors[COUNTER_COUNT] = { -1, -1, -1, -1 };
+    if(options.counters) {
+        counters_open(descriptors);
+    }
+    /*  data generation stays outside the timed windows, every repetition starts from the barrier together */
+    for(uint64_t i = 0; i < options.warmup; i++) {
+        barrier_wait(*barrier);
+        transfer(kernel, source, destination, auxiliary, size, count);
+    }
+    uint64_t timed_faults = 0;
+    for(uint64_t i = 0; i < options.repeat; i++) {
+        /*  the memory controllers count system wide, they are switched on before any thread leaves the barrier and
+            stay on until the last thread is done */
+        barrier_wait(*barrier, imc_descriptors.empty() ? nullptr : imc_enable);
+        uint64_t before = page_faults();
+        /*  toggles every counter this thread opened, the timestamps sit inside so that the counters cover the loop */
+        if(options.counters) {
+            prctl(PR_TASK_PERF_EVENTS_ENABLE);
+        }
+        result->starts.push_back(nanoseconds_now());
+        transfer(kernel, source, destination, auxiliary, size, count);
+        result->ends.push_back(nanoseconds_now());
+        if(options.counters) {
+            prctl(PR_TASK_PERF_EVENTS_DISABLE);
+        }
+        timed_faults += page_faults() - before;
+        if(!imc_descriptors.empty()) {
+            barrier_wait(*barrier, imc_disable);
+        }
+    }
+    counters_close(descriptors, result->counts);
+    result->faults = page_faults() - faults + helper_faults;
+    result->timed_faults = timed_faults;
+    stats_struct stats = stats_compute(durations_of(*result));
+
+    if(verbose()) {
+        guard.lock();
+        if(!placement.empty() || options.numa != NUMA_NONE) {
+            std::cout << "[Thread #" << id + 1 << "] Ran on CPU " << result->cpu << ", node " << result->node << ", destination on node " << destination_node << ".\n";
+        }
+        std::cout << "[Thread #" << id + 1 << "] Finished " << options.repeat << " repetitions of " << count << " " << kernel->name << " transfers of " << sizeof(uint8_t)*size << " byte memory block from " << allocator->name << ".\n";
+        std::cout << "[Thread #" << id + 1 << "] Page faults: " << result->faults << " in total, " << result->timed_faults << " while timed.\n";
+        if(options.counters) {
+            std::cout << "[Thread #" << id + 1 << "] Counters:";
+            for(int i = 0; i < COUNTER_COUNT; i++) {
+                std::cout << " " << counters[i].name << " " << (result->counts[i] < 0 ? std::string("n/a") : std::to_string(result->counts[i]));
+            }
+            std::cout << ".\n";
+        }
+        std::cout << "[Thread #" << id + 1 << "] Repetition time: min " << stats.min << " ns, median " << stats.median << " ns, p99 " << stats.p99 << " ns, stddev " << (uint64_t)stats.stddev << " ns.\n";
+        if(kernel->verify == VERIFY_CHASE) {
+            std::cout << "[Thread #" << id + 1 << "] Latency: " << chase_latency(stats.median, count, size) << " ns per access over " << options.chains << " chains.\n";
+        }
+        else if(stats.median != 0) {
+            std::cout << "[Thread #" << id + 1 << "] Transfers per second: " << bandwidth_over(count, stats.median) << ".\n";
+            std::cout << "[Thread #" << id + 1 << "] Memory bandwidth: " << bandwidth_over(count*kernel->traffic*sizeof(uint8_t)*size, stats.median) << " bytes/second.\n";
+        }
+        std::cout << "[Thread #" << id + 1 << "] Verifying output...\n";
+        guard.unlock();
+    }
+    if(kernel->verify == VERIFY_CHASE) {
+        if(!chase_verify(source, size)) {
+            guard.lock();
+            std::cout << "[Thread #" << id + 1 << "] Verify failed! The pointer chain is not a single cycle.\n";
+            guard.unlock();
+            isgood = false;
+        }
+    }
+    else if(kernel->verify != VERIFY_NONE) {
+        mismatch_list mismatches = verify_parallel(kernel, source, destination, auxiliary, size, seed);
+        if(!mismatches.empty()) {
+            uint64_t wrong = 0;
+            for(const auto& range : mismatches) {
+                wrong += range.second - range.first;
+            }
+            guard.lock();
+            std::cout << "[Thread #" << id + 1 << "] Verify failed! " << wrong << " bytes wrong in " << mismatches.size() << " ranges:";
+            for(size_t i = 0; i < std::min<size_t>(mismatches.size(), MISMATCH_REPORT_MAX); i++) {
+                std::cout << " [" << mismatches[i].first << ", " << mismatches[i].second << ")";
+            }
+            std::cout << (mismatches.size() > MISMATCH_REPORT_MAX ? " ...\n" : "\n");
+            guard.unlock();
+            isgood = false;
+        }
+    }
+    buffer_free(source_buffer);
+    buffer_free(destination_buffer);
+    buffer_free(auxiliary_buffer);
+    result->kernel = kernel;
+    result->allocator = allocator;
+    result->size = size;
+    result->count = count;
+    result->verified = isgood;
+    if(isgood == true) {
+        if(verbose()) {
+            guard.lock();
+            std::cout << "[Thread #" << id + 1 << "] Output OK.\n";
+            guard.unlock();
+        }
+        return 0;
+    }
+    return 1;
+}
+
+/*  one of the calibration threads, placed and allocated like processor() so that threads sharing bandwidth slow each
+    other down the same way. Every thread sees the same timings after the second barrier and takes the same decision */
+static void calibrate_processor(int id, const kernel_struct* kernel, const allocator_struct* allocator, uint64_t size, barrier_struct* barrier, std::vector<double>* seconds, uint64_t* result) {
+    int source_node = (options.numa == NUMA_NODE) ? options.numa_node : node_of(pin_thread(id));
+    int destination_node = (options.numa == NUMA_CROSS) ? node_next(source_node) : source_node;
+    buffer_struct source_buffer = buffer_allocate(size, source_node, allocator);
+    buffer_struct destination_buffer = buffer_allocate(size, destination_node, allocator);
+    buffer_struct auxiliary_buffer = buffer_allocate(size, source_node, allocator);
+    uint64_t count = 1;
+    double slowest = 0;
+
+    /*  zeroes keep the floating point kernels away from NaNs and denormals */
+    memset(source_buffer.data, 0, size);
+    memset(destination_buffer.data, 0, size);
+    memset(auxiliary_buffer.data, 0, size);
+    if(kernel->verify == VERIFY_CHASE) {
+        chase_build(source_buffer.data, destination_buffer.data, size, 0);
+    }
+    while(true) {
+        barrier_wait(*barrier);
+        auto start = std::chrono::steady_clock::now();
+        transfer(kernel, source_buffer.data, destination_buffer.data, auxiliary_buffer.data, size, count);
+        (*seconds)[id] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        barrier_wait(*barrier);
+        slowest = *std::max_element(seconds->begin(), seconds->end());
+        if(slowest >= options.budget / (options.warmup + options.repeat) / 8) {
+            break;
+        }
+        count = count * 2;
+    }
+    buffer_free(source_buffer);
+    buffer_free(destination_buffer);
+    buffer_free(auxiliary_buffer);
+    /*  the budget covers the warmup and every repetition together */
+    if(id == 0) {
+        *result = std::max<uint64_t>(1, (uint64_t)(count * options.budget / (options.warmup + options.repeat) / slowest));
+    }
+}
+
+/*  doubles the number of transfers until a run takes a noticeable slice of the budget, then scales up to the full budget.
+    It runs on every thread at once with the first selected allocator, at DRAM sizes the threads share the bandwidth */
+static uint64_t calibrate(const kernel_struct* kernel, const allocator_struct* allocator, uint64_t size) {
+    std::vector<std::thread> thread_array;
+    std::vector<double> seconds(options.threads_count, 0);
+    barrier_struct barrier;
+    uint64_t count = 1;
+
+    barrier.count = options.threads_count;
+    for(uint64_t i = 0; i < options.threads_count; i++) {
+        thread_array.emplace_back(calibrate_processor, i, kernel, allocator, size, &barrier, &seconds, &count);
+    }
+    for(std::thread& thread : thread_array) {
+        thread.join();
+    }
+    return count;
+}
+
+static std::vector<result_struct> run(const kernel_struct* kernel, const allocator_struct* allocator, uint64_t size, uint64_t count) {
+    std::vector<std::thread> thread_array(options.threads_count);
+    std::vector<result_struct> results(options.threads_count);
+    barrier_struct barrier;
+
+    barrier.count = options.threads_count;
+    imc_control(PERF_EVENT_IOC_RESET);
+    for(uint64_t i = 0; i < options.threads_count; i++) {
+        if(verbose()) {
+            std::cout << "Spawned thread #" << i + 1 << "\n";
+        }
+        thread_array.at(i) = std::thread(processor, i, kernel, allocator, size, count, &barrier, &results.at(i));
+    }
+    for(uint64_t i = 0; i < options.threads_count; i++) {
+        thread_array.at(i).join();
+    }
+    results[0].memory_bytes = imc_bytes();
+    return results;
+}
+
+/*  head is only written by the producer and tail only by the consumer, each on its own cache line. Both count messages
+    from the start of the run, the slot is the count modulo --slots */
+struct ring_struct {
+    alignas(CACHE_LINE) std::atomic<uint64_t> head{0};
+    alignas(CACHE_LINE) std::atomic<uint64_t> tail{0};
+    alignas(CACHE_LINE) buffer_struct buffer;
+};
+
+struct pair_struct {
+    ring_struct forward;
+    ring_struct backward;
+    int cpus[2] = { -1, -1 };
+    /*  the producer's messages, published before the first barrier so that the consumer can check the payloads */
+    const uint8_t* source = nullptr;
+    /*  the producer stamps when a repetition starts, the consumer when the last message of it has arrived */
+    std::vector<uint64_t> starts;
+    std::vector<uint64_t> ends;
+    std::vector<uint64_t> round_trips;
+    bool verified = true;
+};
+
+/*  the first word of every message carries its sequence number, the rest is the payload */
+static void ring_send(ring_struct& ring, const uint8_t* message, uint64_t sequence, uint64_t& tail) {
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+
+    for(uint64_t spins = 0; head - tail == options.slots; spins++) {
+        tail = ring.tail.load(std::memory_order_acquire);
+        if(spins >= SPIN_LIMIT) {
+            std::this_thread::yield();
+        }
+    }
+    uint8_t* slot = ring.buffer.data + (head & (options.slots - 1)) * options.message;
+    memcpy(slot, message, options.message);
+    memcpy(slot, &sequence, sizeof(sequence));
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+static uint64_t ring_receive(ring_struct& ring, uint8_t* message, uint64_t& head) {
+    uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+    uint64_t sequence = 0;
+
+    for(uint64_t spins = 0; tail == head; spins++) {
+        head = ring.head.load(std::memory_order_acquire);
+        if(spins >= SPIN_LIMIT) {
+            std::this_thread::yield();
+        }
+    }
+    memcpy(message, ring.buffer.data + (tail & (options.slots - 1)) * options.message, options.message);
+    ring.tail.store(tail + 1, std::memory_order_release);
+    memcpy(&sequence, message, sizeof(sequence));
+    return sequence;
+}
+
+/*  message n is taken from slot n of the producer's source and lands in slot n of the consumer's destination */
+static void pair_producer(int id, uint64_t count, barrier_struct* barrier, pair_struct* pair) {
+    uint64_t length = options.slots * options.message;
+    uint8_t* source = new uint8_t[length];
+    uint8_t* reply = new uint8_t[options.message];
+    uint64_t sent = 0;
+    uint64_t forward_tail = 0;
+    uint64_t backward_head = 0;
+
+    pair->cpus[0] = pin_thread(id);
+    generator_fill(source, 0, length, ((uint64_t)hrng() << 32) | hrng(), false);
+    pair->source = source;
+    for(uint64_t r = 0; r < options.warmup + options.repeat; r++) {
+        bool timed = (r >= options.warmup);
+        barrier_wait(*barrier);
+        uint64_t start = nanoseconds_now();
+        for(uint64_t i = 0; i < count; i++, sent++) {
+            ring_send(pair->forward, source + (sent & (options.slots - 1)) * options.message, sent, forward_tail);
+        }
+        if(timed) {
+            pair->starts.push_back(start);
+        }
+        barrier_wait(*barrier);
+        for(uint64_t i = 0; i < std::min<uint64_t>(count, ROUND_TRIPS_MAX); i++, sent++) {
+            uint64_t before = nanoseconds_now();
+            ring_send(pair->forward, source + (sent & (options.slots - 1)) * options.message, sent, forward_tail);
+            if(ring_receive(pair->backward, reply, backward_head) != sent) {
+                pair->verified = false;
+            }
+            if(timed) {
+                pair->round_trips.push_back(nanoseconds_now() - before);
+            }
+        }
+    }
+    /*  the consumer still compares against the source once its last message is in */
+    barrier_wait(*barrier);
+    barrier_wait(*barrier);
+    delete[] source;
+    delete[] reply;
+}
+
+static void pair_consumer(int id, uint64_t count, barrier_struct* barrier, pair_struct* pair) {
+    uint64_t length = options.slots * options.message;
+    uint8_t* destination = new uint8_t[length];
+    uint64_t received = 0;
+    uint64_t forward_head = 0;
+    uint64_t backward_tail = 0;
+
+    pair->cpus[1] = pin_thread(id);
+    for(uint64_t r = 0; r < options.warmup + options.repeat; r++) {
+        bool timed = (r >= options.warmup);
+        barrier_wait(*barrier);
+        for(uint64_t i = 0; i < count; i++, received++) {
+            if(ring_receive(pair->forward, destination + (received & (options.slots - 1)) * options.message, forward_head) != received) {
+                pair->verified = false;
+            }
+        }
+        if(timed) {
+            pair->ends.push_back(nanoseconds_now());
+        }
+        barrier_wait(*barrier);
+        for(uint64_t i = 0; i < std::min<uint64_t>(count, ROUND_TRIPS_MAX); i++, received++) {
+            uint8_t* message = destination + (received & (options.slots - 1)) * options.message;
+            if(ring_receive(pair->forward, message, forward_head) != received) {
+                pair->verified = false;
+            }
+            ring_send(pair->backward, message, received, backward_tail);
+        }
+    }
+    barrier_wait(*barrier);
+    for(uint64_t slot = 0; slot < std::min(received, options.slots); slot++) {
+        uint64_t offset = slot * options.message + sizeof(uint64_t);
+        if(memcmp(destination + offset, pair->source + offset, options.message - sizeof(uint64_t)) != 0) {
+            pair->verified = false;
+        }
+    }
+    barrier_wait(*barrier);
+    delete[] destination;
+}
+
+/*  thread 2i produces for pair i and thread 2i + 1 consumes, the rings are set up here on the producer's node */
+static std::vector<pair_struct*> run_pairs(const allocator_struct* allocator, uint64_t count) {
+    std::vector<std::thread> thread_array(2 * options.pairs);
+    std::vector<pair_struct*> pairs(options.pairs);
+    barrier_struct barrier;
+
+    barrier.count = 2 * options.pairs;
+    for(uint64_t i = 0; i < options.pairs; i++) {
+        int node = placement.empty() ? 0 : node_of(placement.at(2 * i));
+        node = (options.numa == NUMA_NODE) ? options.numa_node : (options.numa == NUMA_CROSS) ? node_next(node) : node;
+        pairs[i] = new pair_struct;
+        pairs[i]->forward.buffer = buffer_allocate(options.slots * options.message, node, allocator);
+        pairs[i]->backward.buffer = buffer_allocate(options.slots * options.message, node, allocator);
+        thread_array.at(2 * i) = std::thread(pair_producer, 2 * i, count, &barrier, pairs[i]);
+        thread_array.at(2 * i + 1) = std::thread(pair_consumer, 2 * i + 1, count, &barrier, pairs[i]);
+    }
+    for(std::thread& thread : thread_array) {
+        thread.join();
+    }
+    for(pair_struct* pair : pairs) {
+        buffer_free(pair->forward.buffer);
+        buffer_free(pair->backward.buffer);
+    }
+    return pairs;
+}
+
+static std::vector<uint64_t> pair_windows(const std::vector<pair_struct*>& pairs) {
+    std::vector<uint64_t> windows;
+
+    for(size_t r = 0; r < pairs[0]->starts.size(); r++) {
+        uint64_t start = UINT64_MAX;
+        uint64_t end = 0;
+        for(const pair_struct* pair : pairs) {
+            start = std::min(start, pair->starts[r]);
+            end = std::max(end, pair->ends[r]);
+        }
+        windows.push_back(end - start);
+    }
+    return windows;
+}
+
+/*  one row for all pairs together followed by one per pair, throughput over the median window and round trip times over
+    every ping-pong of the timed repetitions */
+static void report_pairs(std::ostream& out, const std::vector<pair_struct*>& pairs, uint64_t count) {
+    for(size_t i = 0; i <= pairs.size(); i++) {
+        std::vector<pair_struct*> scope = (i == 0) ? pairs : std::vector<pair_struct*>(1, pairs[i - 1]);
+        std::vector<uint64_t> round_trips;
+        bool verified = true;
+
+        for(const pair_struct* pair : scope) {
+            round_trips.insert(round_trips.end(), pair->round_trips.begin(), pair->round_trips.end());
+            verified = verified && pair->verified;
+        }
+        stats_struct stats = stats_compute(pair_windows(scope));
+        stats_struct rtt = stats_compute(round_trips);
+        uint64_t messages = bandwidth_over(scope.size() * count, stats.median);
+        uint64_t bandwidth = bandwidth_over(scope.size() * count * options.message, stats.median);
+        std::string cpus = (i == 0) ? "" : std::to_string(scope[0]->cpus[0]) + ":" + std::to_string(scope[0]->cpus[1]);
+
+        if(options.format == "csv") {
+            out << "spsc," << options.message << "," << options.slots << "," << pairs.size() << "," << (i == 0 ? "all" : "pair" + std::to_string(i)) << "," << cpus << ",";
+            out << count << "," << options.repeat << "," << stats.min << "," << stats.median << "," << stats.p99 << "," << (uint64_t)stats.stddev << "," << messages << "," << bandwidth << ",";
+            out << rtt.min << "," << rtt.median << "," << rtt.p99 << "," << (uint64_t)rtt.stddev << "," << verified << "\n";
+        }
+        else if(options.format == "json") {
+            if(i == 0) {
+                out << "\n  { \"mode\": \"spsc\", \"message\": " << options.message << ", \"slots\": " << options.slots << ", \"pairs\": " << pairs.size() << ", \"count\": " << count << ", \"repeat\": " << options.repeat << ", ";
+            }
+            else {
+                out << (i == 1 ? ", \"per_pair\": [ " : ", ") << "{ \"producer_cpu\": " << scope[0]->cpus[0] << ", \"consumer_cpu\": " << scope[0]->cpus[1] << ", ";
+            }
+            out << "\"min_ns\": " << stats.min << ", \"median_ns\": " << stats.median << ", \"p99_ns\": " << stats.p99 << ", \"stddev_ns\": " << (uint64_t)stats.stddev;
+            out << ", \"messages_per_second\": " << messages << ", \"bytes_per_second\": " << bandwidth << ", \"rtt_min_ns\": " << rtt.min << ", \"rtt_median_ns\": " << rtt.median;
+            out << ", \"rtt_p99_ns\": " << rtt.p99 << ", \"rtt_stddev_ns\": " << (uint64_t)rtt.stddev << ", \"verified\": " << (verified ? "true" : "false");
+            out << ((i == 0) ? "" : " }") << ((i == pairs.size()) ? " ] }" : "");
+        }
+        else {
+            if(i == 0) {
+                out << "spsc, " << options.message << " byte messages through " << options.slots << " slots on " << pairs.size() << " pairs: " << options.repeat << " x " << count << " messages, ";
+            }
+            else {
+                out << "    pair " << i << " (CPU " << scope[0]->cpus[0] << " to " << scope[0]->cpus[1] << "): ";
+            }
+            out << messages << " messages/second, " << bandwidth << " bytes/second, round trip min " << rtt.min << " ns, median " << rtt.median << " ns, p99 " << rtt.p99 << " ns";
+            out << (verified ? ".\n" : ", verify FAILED.\n");
+            if(i == 0) {
+                out << "    window: min " << stats.min << " ns, median " << stats.median << " ns, p99 " << stats.p99 << " ns, stddev " << (uint64_t)stats.stddev << " ns.\n";
+            }
+        }
+    }
+}
+
+enum io_method {
+    IO_READ,
+    IO_PREAD,
+    IO_MMAP,
+    IO_DIRECT,
+    IO_URING
+};
+
+static bool direct_supported(void) {
+    int descriptor = open(options.file.c_str(), O_RDONLY | O_DIRECT);
+
+    if(descriptor < 0) {
+        return false;
+    }
+    close(descriptor);
+    return true;
+}
+
+static bool uring_supported(void) {
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    int descriptor = syscall(SYS_io_uring_setup, 1, &params);
+    if(descriptor < 0) {
+        return false;
+    }
+    close(descriptor);
+    return true;
+}
+
+/*  the file methods pose as kernels so that the reporting and verification carry over, traffic is the bytes loaded */
+static const kernel_struct io_kernels[] = {
+    { "read", nullptr, always_supported, 1, VERIFY_COPY, false },
+    { "pread", nullptr, always_supported, 1, VERIFY_COPY, false },
+    { "mmap", nullptr, always_supported, 1, VERIFY_COPY, false },
+    { "direct", nullptr, direct_supported, 1, VERIFY_COPY, false },
+    { "io_uring", nullptr, uring_supported, 1, VERIFY_COPY, false }
+};
+
+static io_method method_of(const kernel_struct* kernel) {
+    return (io_method)(kernel - io_kernels);
+}
+
+/*  the rings of one io_uring instance, mapped from the descriptor io_uring_setup returns */
+struct uring_struct {
+    int descriptor = -1;
+    uint8_t* submission_ring = nullptr;
+    uint8_t* completion_ring = nullptr;
+    size_t submission_length = 0;
+    size_t completion_length = 0;
+    struct io_uring_sqe* entries = nullptr;
+    size_t entries_length = 0;
+    struct io_uring_params params;
+};
+
+static bool uring_open(uring_struct& uring, uint64_t depth) {
+    memset(&uring.params, 0, sizeof(uring.params));
+    uring.descriptor = syscall(SYS_io_uring_setup, depth, &uring.params);
+    if(uring.descriptor < 0) {
+        return false;
+    }
+    uring.submission_length = uring.params.sq_off.array + uring.params.sq_entries * sizeof(unsigned);
+    uring.completion_length = uring.params.cq_off.cqes + uring.params.cq_entries * sizeof(struct io_uring_cqe);
+    if(uring.params.features & IORING_FEAT_SINGLE_MMAP) {
+        uring.submission_length = uring.completion_length = std::max(uring.submission_length, uring.completion_length);
+    }
+    uring.submission_ring = (uint8_t*)mmap(nullptr, uring.submission_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.descriptor, IORING_OFF_SQ_RING);
+    uring.completion_ring = (uring.params.features & IORING_FEAT_SINGLE_MMAP) ? uring.submission_ring :
+                            (uint8_t*)mmap(nullptr, uring.completion_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.descriptor, IORING_OFF_CQ_RING);
+    uring.entries_length = uring.params.sq_entries * sizeof(struct io_uring_sqe);
+    uring.entries = (struct io_uring_sqe*)mmap(nullptr, uring.entries_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.descriptor, IORING_OFF_SQES);
+    return uring.submission_ring != MAP_FAILED && uring.completion_ring != MAP_FAILED && uring.entries != MAP_FAILED;
+}
+
+static void uring_close(uring_struct& uring) {
+    munmap(uring.entries, uring.entries_length);
+    if(uring.completion_ring != uring.submission_ring) {
+        munmap(uring.completion_ring, uring.completion_length);
+    }
+    munmap(uring.submission_ring, uring.submission_length);
+    close(uring.descriptor);
+}
+
+/*  reads [begin, end) of the file into destination keeping up to --depth requests in flight, a short read is submitted
+    again for the rest of its block. Each request's offset and length sit in a slot of a side table, user_data only
+    carries the slot. Returns false on an I/O error */
+static bool uring_read(uring_struct& uring, int descriptor, uint8_t* destination, uint64_t begin, uint64_t end) {
+    unsigned* submission_tail = (unsigned*)(uring.submission_ring + uring.params.sq_off.tail);
+    unsigned submission_mask = *(unsigned*)(uring.submission_ring + uring.params.sq_off.ring_mask);
+    unsigned* submission_array = (unsigned*)(uring.submission_ring + uring.params.sq_off.array);
+    unsigned* completion_head = (unsigned*)(uring.completion_ring + uring.params.cq_off.head);
+    unsigned* completion_tail = (unsigned*)(uring.completion_ring + uring.params.cq_off.tail);
+    unsigned completion_mask = *(unsigned*)(uring.completion_ring + uring.params.cq_off.ring_mask);
+    struct io_uring_cqe* completions = (struct io_uring_cqe*)(uring.completion_ring + uring.params.cq_off.cqes);
+    std::vector<std::pair<uint64_t, uint64_t>> pending;
+    std::vector<std::pair<uint64_t, uint64_t>> requests(uring.params.sq_entries);
+    std::vector<uint64_t> free_slots;
+    uint64_t next = begin;
+    uint64_t in_flight = 0;
+
+    for(uint64_t slot = requests.size(); slot > 0; slot--) {
+        free_slots.push_back(slot - 1);
+    }
+    while(next < end || in_flight != 0 || !pending.empty()) {
+        unsigned tail = *submission_tail;
+        unsigned queued = 0;
+        while(in_flight + queued < uring.params.sq_entries && (next < end || !pending.empty())) {
+            uint64_t offset = next;
+            uint64_t length = std::min<uint64_t>({ options.block, URING_LENGTH_MAX, end - next });
+            if(!pending.empty()) {
+                offset = pending.back().first;
+                length = pending.back().second;
+                pending.pop_back();
+            }
+            else {
+                next += length;
+            }
+            struct io_uring_sqe* entry = &uring.entries[(tail + queued) & submission_mask];
+            memset(entry, 0, sizeof(*entry));
+            entry->opcode = IORING_OP_READ;
+            entry->fd = descriptor;
+            entry->addr = (uint64_t)(destination + offset - begin);
+            entry->len = length;
+            entry->off = offset;
+            entry->user_data = free_slots.back();
+            requests[free_slots.back()] = { offset, length };
+            free_slots.pop_back();
+            submission_array[(tail + queued) & submission_mask] = (tail + queued) & submission_mask;
+            queued++;
+        }
+        __atomic_store_n(submission_tail, tail + queued, __ATOMIC_RELEASE);
+        if(syscall(SYS_io_uring_enter, uring.descriptor, queued, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0) {
+            return false;
+        }
+        in_flight += queued;
+        unsigned head = *completion_head;
+        while(head != __atomic_load_n(completion_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe* completion = &completions[head & completion_mask];
+            uint64_t offset = requests[completion->user_data].first;
+            uint64_t length = requests[completion->user_data].second;
+            free_slots.push_back(completion->user_data);
+            if(completion->res < 0) {
+                return false;
+            }
+            /*  a zero length read means the file ended early */
+            if(completion->res != 0 && (uint64_t)completion->res < length) {
+                pending.emplace_back(offset + completion->res, length - completion->res);
+            }
+            in_flight--;
+            head++;
+        }
+        __atomic_store_n(completion_head, head, __ATOMIC_RELEASE);
+    }
+    return true;
+}
+
+/*  loads [begin, end) of the test file into destination with the given method, false on an I/O error */
+static bool io_load(io_method method, int descriptor, uring_struct& uring, uint8_t* destination, uint64_t begin, uint64_t end) {
+    uint64_t done = 0;
+
+    /*  with more threads than blocks in the file some slices are empty, and mmap refuses a zero length */
+    if(begin == end) {
+        return true;
+    }
+    if(method == IO_MMAP) {
+        void* mapping = mmap(nullptr, end - begin, PROT_READ, MAP_SHARED, descriptor, begin);
+        if(mapping == MAP_FAILED) {
+            return false;
+        }
+        memcpy(destination, mapping, end - begin);
+        munmap(mapping, end - begin);
+        return true;
+    }
+    if(method == IO_URING) {
+        return uring_read(uring, descriptor, destination, begin, end);
+    }
+    if(method == IO_READ && lseek(descriptor, begin, SEEK_SET) < 0) {
+        return false;
+    }
+    while(begin + done < end) {
+        /*  plain read leaves the request size to the kernel, the others go a block at a time. O_DIRECT rounds the last
+            request up to the alignment and gets a short read at the end of the file */
+        uint64_t length = (method == IO_READ) ? end - begin - done : std::min(options.block, end - begin - done);
+        if(method == IO_DIRECT) {
+            length = (length + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+        }
+        ssize_t got = (method == IO_READ) ? read(descriptor, destination + done, length) : pread(descriptor, destination + done, length, begin + done);
+        if(got <= 0) {
+            return got == 0;
+        }
+        done += got;
+    }
+    return true;
+}
+
+/*  user plus system time of the calling thread, at a finer grain than getrusage's ticks */
+static uint64_t cpu_time(void) {
+    struct timespec time;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return time.tv_sec * 1000000000ull + time.tv_nsec;
+}
+
+/*  the file mode's worker, the slice is [begin, end) of the file */
+static int io_processor(int id, const kernel_struct* kernel, const allocator_struct* allocator, uint64_t begin, uint64_t end, barrier_struct* barrier, result_struct* result) {
+    io_method method = method_of(kernel);
+    uint64_t size = end - begin;
+
+    result->cpu = pin_thread(id);
+    result->node = node_of(result->cpu);
+
+    int node = (options.numa == NUMA_NODE) ? options.numa_node : (options.numa == NUMA_CROSS) ? node_next(result->node) : result->node;
+    /*  O_DIRECT needs an aligned buffer, which plain new does not give */
+    buffer_struct destination_buffer = buffer_allocate((size + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN, node, (method == IO_DIRECT && allocator->mode == ALLOC_NEW) ? &allocators[ALLOC_MMAP] : allocator);
+    uint8_t* destination = destination_buffer.data;
+    int descriptor = open(options.file.c_str(), O_RDONLY | (method == IO_DIRECT ? O_DIRECT : 0));
+    uring_struct uring;
+    bool isgood = descriptor >= 0 && (method != IO_URING || uring_open(uring, options.depth));
+    uint64_t faults = page_faults();
+
+    for(uint64_t r = 0; r < options.warmup + options.repeat; r++) {
+        if(!options.hot && descriptor >= 0) {
+            posix_fadvise(descriptor, begin, size, POSIX_FADV_DONTNEED);
+        }
+        barrier_wait(*barrier);
+        uint64_t cpu_before = cpu_time();
+        uint64_t start = nanoseconds_now();
+        isgood = isgood && io_load(method, descriptor, uring, destination, begin, end);
+        uint64_t finish = nanoseconds_now();
+        if(r >= options.warmup) {
+            result->starts.push_back(start);
+            result->ends.push_back(finish);
+            result->cpu_ns += cpu_time() - cpu_before;
+        }
+    }
+    result->faults = page_faults() - faults;
+    if(!isgood) {
+        std::lock_guard<std::mutex> guard(lock_stdout);
+        std::cout << "[Thread #" << id + 1 << "] " << kernel->name << " of " << options.file << " failed: " << strerror(errno) << ".\n";
+    }
+    /*  the generator is indexed by word, so the slice's words start further along the sequence */
+    else if(!verify_parallel(kernel, destination, destination, destination, size, FILE_SEED + begin / sizeof(uint64_t) * GENERATOR_GOLDEN).empty()) {
+        std::lock_guard<std::mutex> guard(lock_stdout);
+        std::cout << "[Thread #" << id + 1 << "] Verify failed! " << options.file << " does not hold the expected data, was it written by this program?\n";
+        isgood = false;
+    }
+    if(method == IO_URING && uring.descriptor >= 0) {
+        uring_close(uring);
+    }
+    if(descriptor >= 0) {
+        close(descriptor);
+    }
+    buffer_free(destination_buffer);
+    result->kernel = kernel;
+    result->allocator = allocator;
+    result->size = size;
+    result->count = 1;
+    result->verified = isgood;
+    return isgood ? 0 : 1;
+}
+
+/*  slices are aligned for O_DIRECT, the last thread takes whatever is left */
+static std::vector<result_struct> run_io(const kernel_struct* kernel, const allocator_struct* allocator, uint64_t file_size) {
+    std::vector<std::thread> thread_array(options.threads_count);
+    std::vector<result_struct> results(options.threads_count);
+    uint64_t slice = (file_size / options.threads_count + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+    barrier_struct barrier;
+
+    barrier.count = options.threads_count;
+    for(uint64_t i = 0; i < options.threads_count; i++) {
+        uint64_t begin = std::min(file_size, i * slice);
+        uint64_t end = (i + 1 == options.threads_count) ? file_size : std::min(file_size, (i + 1) * slice);
+        thread_array.at(i) = std::thread(io_processor, i, kernel, allocator, begin, end, &barrier, &results.at(i));
+    }
+    for(std::thread& thread : thread_array) {
+        thread.join();
+    }
+    return results;
+}
+
+/*  writes the generator's data to a missing test file, returns the size of the file or 0 if it is unusable */
+static uint64_t io_prepare(void) {
+    struct stat status;
+
+    if(stat(options.file.c_str(), &status) == 0) {
+        return status.st_size;
+    }
+    if(options.size == 0) {
+        std::cerr << options.file << " does not exist, give --size to create it.\n";
+        return 0;
+    }
+    int descriptor = open(options.file.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    std::vector<uint8_t> chunk(CHUNK_MIN);
+    if(descriptor < 0) {
+        std::cerr << "Could not create " << options.file << ": " << strerror(errno) << ".\n";
+        return 0;
+    }
+    for(uint64_t offset = 0; offset < options.size; offset += chunk.size()) {
+        uint64_t length = std::min<uint64_t>(chunk.size(), options.size - offset);
+        generator_fill(chunk.data(), 0, length, FILE_SEED + offset / sizeof(uint64_t) * GENERATOR_GOLDEN, false);
+        if(write(descriptor, chunk.data(), length) != (ssize_t)length) {
+            std::cerr << "Could not write " << options.file << ": " << strerror(errno) << ".\n";
+            close(descriptor);
+            return 0;
+        }
+    }
+    /*  written back so that dropping it from the page cache actually works */
+    fsync(descriptor);
+    close(descriptor);
+    std::cerr << "Created " << options.file << " with " << options.size << " bytes.\n";
+    return options.size;
+}
+
+/*  rdtsc can start before earlier instructions finish and rdtscp lets later ones start early, the fences keep the copies
+    between the two timestamps */
+static uint64_t ticks_begin(void) {
+#if defined(__x86_64__)
+    _mm_lfence();
+    uint64_t ticks = __rdtsc();
+    _mm_lfence();
+    return ticks;
+#else
+    return nanoseconds_now();
+#endif
+}
+
+static uint64_t ticks_end(void) {
+#if defined(__x86_64__)
+    unsigned processor;
+    uint64_t ticks = __rdtscp(&processor);
+    _mm_lfence();
+    return ticks;
+#else
+    return nanoseconds_now();
+#endif
+}
+
+static void kernel_empty(uint8_t*, const uint8_t*, const uint8_t*, uint64_t) {
+}
+
+/*  the median over the samples of SMALL_BATCH back to back copies, in ticks per copy, through the function pointer or,
+    for fixed, with memcpy of a compile time size inlined into the loop */
+static double small_time(kernel_function function, uint8_t* destination, const uint8_t* source, uint64_t size) {
+    std::vector<uint64_t> samples;
+
+    function(destination, source, nullptr, size);
+    for(uint64_t i = 0; i < SMALL_SAMPLES; i++) {
+        uint64_t start = ticks_begin();
+        for(uint64_t j = 0; j < SMALL_BATCH; j++) {
+            function(destination, source, nullptr, size);
+        }
+        samples.push_back(ticks_end() - start);
+    }
+    return (double)stats_compute(samples).median / SMALL_BATCH;
+}
+
+template<uint64_t size>
+static double small_time_fixed(uint8_t* destination, const uint8_t* source) {
+    std::vector<uint64_t> samples;
+
+    for(uint64_t i = 0; i < SMALL_SAMPLES; i++) {
+        uint64_t start = ticks_begin();
+        for(uint64_t j = 0; j < SMALL_BATCH; j++) {
+            memcpy(destination, source, size);
+            /*  keeps the compiler from merging the copies of the batch into one */
+            asm volatile("" : : "r"(destination), "r"(source) : "memory");
+        }
+        samples.push_back(ticks_end() - start);
+    }
+    return (double)stats_compute(samples).median / SMALL_BATCH;
+}
+
+/*  -1 for the sizes that have no fixed copy */
+static double small_fixed(uint8_t* destination, const uint8_t* source, uint64_t size) {
+    switch(size) {
+        case 8: return small_time_fixed<8>(destination, source);
+        case 16: return small_time_fixed<16>(destination, source);
+        case 32: return small_time_fixed<32>(destination, source);
+        case 64: return small_time_fixed<64>(destination, source);
+        case 128: return small_time_fixed<128>(destination, source);
+        case 256: return small_time_fixed<256>(destination, source);
+        case 512: return small_time_fixed<512>(destination, source);
+        case 1024: return small_time_fixed<1024>(destination, source);
+        case 2048: return small_time_fixed<2048>(destination, source);
+        case 4096: return small_time_fixed<4096>(destination, source);
+        default: return -1;
+    }
+}
+
+static std::vector<uint64_t> parse_size_list(const std::string& text);
+
+/*  one cell per size and pair of misalignments, a negative time means the kernel has no figure for that cell */
+struct small_cell_struct {
+    uint64_t size;
+    uint64_t source_offset;
+    uint64_t destination_offset;
+    double ticks;
+    bool verified;
+};
+
+static std::vector<small_cell_struct> run_small(const kernel_struct* kernel) {
+    std::vector<uint64_t> sizes = parse_size_list(options.sizes);
+    std::vector<uint64_t> offsets = parse_size_list(options.misalign);
+    std::vector<small_cell_struct> cells;
+    /*  both buffers sit in L1 for the whole matrix, the source is filled once */
+    alignas(CACHE_LINE) static uint8_t source[SMALL_MAX + 2 * CACHE_LINE];
+    alignas(CACHE_LINE) static uint8_t destination[SMALL_MAX + 2 * CACHE_LINE];
+    double overhead = 0;
+
+    generator_fill(source, 0, sizeof(source), ((uint64_t)hrng() << 32) | hrng(), false);
+    /*  both kinds of rows take off their own empty batch, which carries the timestamps as well as the loop */
+    if(kernel != nullptr) {
+        overhead = small_time(kernel_empty, destination, source, 0);
+    }
+    else {
+        overhead = small_time_fixed<0>(destination, source);
+    }
+    for(uint64_t size : sizes) {
+        for(uint64_t source_offset : offsets) {
+            for(uint64_t destination_offset : offsets) {
+                small_cell_struct cell = { size, source_offset, destination_offset, -1, true };
+                memset(destination, 0, sizeof(destination));
+                if(kernel != nullptr) {
+                    cell.ticks = std::max(0.0, small_time(kernel->function, destination + destination_offset, source + source_offset, size) - overhead);
+                }
+                else {
+                    cell.ticks = small_fixed(destination + destination_offset, source + source_offset, size);
+                    if(cell.ticks >= 0) {
+                        cell.ticks = std::max(0.0, cell.ticks - overhead);
+                    }
+                }
+                if(cell.ticks >= 0) {
+                    cell.verified = memcmp(destination + destination_offset, source + source_offset, size) == 0;
+                }
+                cells.push_back(cell);
+            }
+        }
+    }
+    return cells;
+}
+
+/*  csv and json get one row per cell, text gets a table per size with source offsets down and destination offsets
+    across */
+static void report_small(std::ostream& out, const char* name, const std::vector<small_cell_struct>& cells, bool first) {
+    std::vector<uint64_t> offsets = parse_size_list(options.misalign);
+
+    for(size_t i = 0; i < cells.size(); i++) {
+        const small_cell_struct& cell = cells[i];
+        if(options.format == "csv") {
+            out << name << "," << cell.size << "," << cell.source_offset << "," << cell.destination_offset << ",";
+            if(cell.ticks >= 0) {
+                out << cell.ticks;
+            }
+            out << "," << cell.verified << "\n";
+        }
+        else if(options.format == "json") {
+            out << ((first && i == 0) ? "\n" : ",\n") << "  { \"kernel\": \"" << name << "\", \"size\": " << cell.size << ", \"source_misalign\": " << cell.source_offset;
+            out << ", \"destination_misalign\": " << cell.destination_offset << ", \"cycles\": ";
+            if(cell.ticks >= 0) {
+                out << cell.ticks;
+            }
+            else {
+                out << "null";
+            }
+            out << ", \"verified\": " << (cell.verified ? "true" : "false") << " }";
+        }
+        else {
+            if(i % (offsets.size() * offsets.size()) == 0) {
+                out << name << ", " << cell.size << " bytes, cycles per copy by source (rows) and destination (columns) misalignment:\n      ";
+                for(uint64_t offset : offsets) {
+                    out.width(8);
+                    out << offset;
+                }
+            }
+            if(i % offsets.size() == 0) {
+                out << "\n";
+                out.width(6);
+                out << cell.source_offset;
+            }
+            out.width(8);
+            if(cell.ticks >= 0) {
+                out << (uint64_t)std::lround(cell.ticks * 10) / 10.0;
+            }
+            else {
+                out << "-";
+            }
+            if(!cell.verified) {
+                out << "!";
+            }
+            if(i % (offsets.size() * offsets.size()) == offsets.size() * offsets.size() - 1) {
+                out << "\n";
+            }
+        }
+    }
+}
+
+static bool breakdown(void) {
+    return !placement.empty() || options.numa != NUMA_NONE;
+}
+
+/*  a thread's own bandwidth, over its median repetition */
+static uint64_t bandwidth_of(const result_struct& result) {
+    return bandwidth_over(result.count*result.kernel->traffic*result.size, stats_compute(durations_of(result)).median);
+}
+
+/*  the window of every repetition runs from the first thread starting to the last thread finishing */
+static std::vector<uint64_t> windows_of(const std::vector<result_struct>& results) {
+    std::vector<uint64_t> windows;
+
+    for(size_t i = 0; i < results[0].starts.size(); i++) {
+        uint64_t start = UINT64_MAX;
+        uint64_t end = 0;
+        for(const result_struct& result : results) {
+            start = std::min(start, result.starts[i]);
+            end = std::max(end, result.ends[i]);
+        }
+        windows.push_back(end - start);
+    }
+    return windows;
+}
+
+static void report_begin(std::ostream& out) {
+    if(options.format == "csv" && options.small) {
+        out << "kernel,size,source_misalign,destination_misalign,cycles,verified\n";
+    }
+    else if(options.format == "csv" && options.spsc) {
+        out << "mode,message,slots,pairs,scope,cpus,count,repeat,min_ns,median_ns,p99_ns,stddev_ns,messages_per_second,bytes_per_second,rtt_min_ns,rtt_median_ns,rtt_p99_ns,rtt_stddev_ns,verified\n";
+    }
+    else if(options.format == "csv") {
+        out << "kernel,alloc,size,threads,scope,count,repeat,min_ns,median_ns,p99_ns,stddev_ns,bytes_per_second,ns_per_access,ns_per_load,faults,timed_faults,verified";
+        out << (options.file.empty() ? "" : ",cpu_ns");
+        out << (options.counters ? ",cycles,instructions,ipc,llc_misses,dtlb_misses,memory_bytes_per_second\n" : "\n");
+    }
+    else if(options.format == "json") {
+        out << "[";
+    }
+}
+
+/*  the chase kernel's latency columns, left empty for the bandwidth kernels */
+static void report_latency(std::ostream& out, const result_struct& result, uint64_t nanoseconds) {
+    if(result.kernel->verify == VERIFY_CHASE) {
+        double latency = chase_latency(nanoseconds, result.count, result.size);
+        out << "," << latency << "," << latency / options.chains;
+    }
+    else {
+        out << ",,";
+    }
+}
+
+/*  appends the counters in the current format, unavailable ones are left empty, null or n/a. memory_bandwidth is -1 for
+    the rows that do not carry the memory controller figure */
+static void report_counters(std::ostream& out, const int64_t* counts, int64_t memory_bandwidth) {
+    const char* empty = (options.format == "csv") ? "" : (options.format == "json") ? "null" : "n/a";
+    double ipc = (counts[COUNTER_CYCLES] > 0 && counts[COUNTER_INSTRUCTIONS] >= 0) ? (double)counts[COUNTER_INSTRUCTIONS] / counts[COUNTER_CYCLES] : -1;
+
+    if(!options.counters) {
+        return;
+    }
+    if(options.format == "csv") {
+        for(int i = 0; i < COUNTER_COUNT; i++) {
+            out << ",";
+            if(counts[i] >= 0) {
+                out << counts[i];
+            }
+            if(i == COUNTER_INSTRUCTIONS) {
+                out << ",";
+                if(ipc >= 0) {
+                    out << ipc;
+                }
+            }
+        }
+        out << ",";
+        if(memory_bandwidth >= 0) {
+            out << memory_bandwidth;
+        }
+        return;
+    }
+    out << ((options.format == "json") ? ", \"counters\": { " : "    counters: ");
+    for(int i = 0; i < COUNTER_COUNT; i++) {
+        if(options.format == "json") {
+            out << (i == 0 ? "\"" : ", \"") << counters[i].name << "\": ";
+        }
+        else {
+            out << (i == 0 ? "" : ", ") << counters[i].name << " ";
+        }
+        if(counts[i] >= 0) {
+            out << counts[i];
+        }
+        else {
+            out << empty;
+        }
+    }
+    if(options.format == "json") {
+        out << ", \"ipc\": ";
+        if(ipc >= 0) {
+            out << ipc;
+        }
+        else {
+            out << empty;
+        }
+        if(memory_bandwidth >= 0) {
+            out << ", \"memory_bytes_per_second\": " << memory_bandwidth;
+        }
+        out << " }";
+        return;
+    }
+    if(ipc >= 0) {
+        out << ", ipc " << ipc;
+    }
+    if(memory_bandwidth >= 0) {
+        out << ", memory controllers " << memory_bandwidth << " bytes/second";
+    }
+    out << ".\n";
+}
+
+/*  one row per size, the aggregate bandwidth is the traffic of all threads over the median common window. It is followed
+    by one row per thread, and with pinning or NUMA placement by one per node and one per CPU summing the threads' own
+    bandwidths */
+static void report_row(std::ostream& out, const std::vector<result_struct>& results, bool first) {
+    const result_struct& head = results[0];
+    stats_struct stats = stats_compute(windows_of(results));
+    uint64_t traffic = 0;
+    uint64_t cpu_ns = 0;
+    for(const result_struct& result : results) {
+        traffic += result.count*result.kernel->traffic*result.size;
+        cpu_ns += result.cpu_ns;
+    }
+    uint64_t bandwidth = bandwidth_over(traffic, stats.median);
+    /*  the buffer size of one thread, or the whole file that the threads share */
+    uint64_t size = options.file.empty() ? head.size : traffic;
+    bool verified = true;
+    uint64_t faults = 0;
+    uint64_t timed_faults = 0;
+    std::map<int, uint64_t> node_bandwidth;
+    std::map<int, uint64_t> cpu_bandwidth;
+
+    int64_t counts[COUNTER_COUNT] = { 0, 0, 0, 0 };
+    uint64_t window_total = 0;
+    int64_t memory_bandwidth = -1;
+
+    for(uint64_t window : windows_of(results)) {
+        window_total += window;
+    }
+    if(head.memory_bytes >= 0) {
+        memory_bandwidth = bandwidth_over(head.memory_bytes, window_total);
+    }
+    for(const result_struct& result : results) {
+        for(int i = 0; i < COUNTER_COUNT; i++) {
+            counts[i] = (counts[i] < 0 || result.counts[i] < 0) ? -1 : counts[i] + result.counts[i];
+        }
+        faults += result.faults;
+        timed_faults += result.timed_faults;
+        node_bandwidth[result.node] += bandwidth_of(result);
+        cpu_bandwidth[result.cpu] += bandwidth_of(result);
+        verified = verified && result.verified;
+    }
+    if(options.format == "csv") {
+        const char* prefix[] = { "node", "cpu" };
+        const std::map<int, uint64_t>* scopes[] = { &node_bandwidth, &cpu_bandwidth };
+
+        out << head.kernel->name << "," << head.allocator->name << "," << size << "," << results.size() << ",all," << head.count << "," << options.repeat << ",";
+        out << stats.min << "," << stats.median << "," << stats.p99 << "," << (uint64_t)stats.stddev << "," << bandwidth;
+        report_latency(out, head, stats.median);
+        out << "," << faults << "," << timed_faults << "," << verified;
+        if(!options.file.empty()) {
+            out << "," << cpu_ns;
+        }
+        report_counters(out, counts, memory_bandwidth);
+        out << "\n";
+        for(size_t i = 0; i < results.size(); i++) {
+            stats_struct thread_stats = stats_compute(durations_of(results[i]));
+            out << head.kernel->name << "," << head.allocator->name << "," << head.size << "," << results.size() << ",thread" << i + 1 << "," << head.count << "," << options.repeat << ",";
+            out << thread_stats.min << "," << thread_stats.median << "," << thread_stats.p99 << "," << (uint64_t)thread_stats.stddev << "," << bandwidth_of(results[i]);
+            report_latency(out, results[i], thread_stats.median);
+            out << "," << results[i].faults << "," << results[i].timed_faults << "," << results[i].verified;
+            if(!options.file.empty()) {
+                out << "," << results[i].cpu_ns;
+            }
+            report_counters(out, results[i].counts, -1);
+            out << "\n";
+        }
+        for(int k = 0; k < 2 && breakdown(); k++) {
+            for(const auto& entry : *scopes[k]) {
+                out << head.kernel->name << "," << head.allocator->name << "," << head.size << "," << results.size() << "," << prefix[k] << entry.first << "," << head.count << "," << options.repeat << ",,,,," << entry.second << ",,,,," << (options.file.empty() ? "" : ",") << (options.counters ? ",,,,,,\n" : "\n");
+            }
+        }
+    }
+    else if(options.format == "json") {
+        out << (first ? "\n" : ",\n") << "  { \"kernel\": \"" << head.kernel->name << "\", \"alloc\": \"" << head.allocator->name << "\", \"size\": " << size << ", \"threads\": " << results.size() << ", \"count\": " << head.count << ", \"repeat\": " << options.repeat;
+        out << ", \"min_ns\": " << stats.min << ", \"median_ns\": " << stats.median << ", \"p99_ns\": " << stats.p99 << ", \"stddev_ns\": " << (uint64_t)stats.stddev;
+        out << ", \"bytes_per_second\": " << bandwidth;
+        if(head.kernel->verify == VERIFY_CHASE) {
+            out << ", \"stride\": " << options.stride << ", \"chains\": " << options.chains << ", \"ns_per_access\": " << chase_latency(stats.median, head.count, head.size);
+            out << ", \"ns_per_load\": " << chase_latency(stats.median, head.count, head.size) / options.chains;
+        }
+        out << ", \"faults\": " << faults << ", \"timed_faults\": " << timed_faults << ", \"verified\": " << (verified ? "true" : "false");
+        if(!options.file.empty()) {
+            out << ", \"cpu_ns\": " << cpu_ns;
+        }
+        report_counters(out, counts, memory_bandwidth);
+        out << ", \"per_thread\": [";
+        for(size_t i = 0; i < results.size(); i++) {
+            stats_struct thread_stats = stats_compute(durations_of(results[i]));
+            out << (i == 0 ? " " : ", ") << "{ \"cpu\": " << results[i].cpu << ", \"min_ns\": " << thread_stats.min << ", \"median_ns\": " << thread_stats.median << ", \"p99_ns\": " << thread_stats.p99;
+            out << ", \"stddev_ns\": " << (uint64_t)thread_stats.stddev << ", \"bytes_per_second\": " << bandwidth_of(results[i]) << ", \"faults\": " << results[i].faults << ", \"timed_faults\": " << results[i].timed_faults;
+            if(!options.file.empty()) {
+                out << ", \"cpu_ns\": " << results[i].cpu_ns;
+            }
+            report_counters(out, results[i].counts, -1);
+            out << " }";
+        }
+        out << " ]";
+        if(breakdown()) {
+            bool first_entry = true;
+            out << ", \"nodes\": {";
+            for(const auto& entry : node_bandwidth) {
+                out << (first_entry ? " " : ", ") << "\"" << entry.first << "\": " << entry.second;
+                first_entry = false;
+            }
+            first_entry = true;
+            out << " }, \"cpus\": {";
+            for(const auto& entry : cpu_bandwidth) {
+                out << (first_entry ? " " : ", ") << "\"" << entry.first << "\": " << entry.second;
+                first_entry = false;
+            }
+            out << " }";
+        }
+        out << " }";
+    }
+    else {
+        out << head.kernel->name << " from " << head.allocator->name << ", size " << size << " bytes: " << options.repeat << " x " << head.count << " transfers on " << results.size() << " threads, " << bandwidth << " bytes/second";
+        out << (verified ? ".\n" : ", verify FAILED.\n");
+        if(head.kernel->verify == VERIFY_CHASE) {
+            out << "    latency: " << chase_latency(stats.median, head.count, head.size) << " ns per access, " << chase_latency(stats.median, head.count, head.size) / options.chains;
+            out << " ns per load over " << options.chains << " chains with a " << options.stride << " byte stride.\n";
+        }
+        out << "    window: min " << stats.min << " ns, median " << stats.median << " ns, p99 " << stats.p99 << " ns, stddev " << (uint64_t)stats.stddev << " ns.\n";
+        out << "    page faults: " << faults << " in total, " << timed_faults << " while timed.\n";
+        if(!options.file.empty()) {
+            out << "    " << bandwidth / 1e9 << " GB/s, cpu time " << cpu_ns << " ns over " << options.repeat << " repetitions, " << (traffic != 0 ? cpu_ns / 1e6 / (traffic * options.repeat / 1e9) : 0) << " ms per GB.\n";
+        }
+        report_counters(out, counts, memory_bandwidth);
+        /*  verbose runs have already printed every thread */
+        for(size_t i = 0; i < results.size() && !verbose(); i++) {
+            stats_struct thread_stats = stats_compute(durations_of(results[i]));
+            out << "    thread " << i + 1 << ": min " << thread_stats.min << " ns, median " << thread_stats.median << " ns, p99 " << thread_stats.p99 << " ns, stddev " << (uint64_t)thread_stats.stddev << " ns.\n";
+        }
+        if(breakdown()) {
+            for(const auto& entry : node_bandwidth) {
+                out << "    node " << entry.first << ": " << entry.second << " bytes/second.\n";
+            }
+            for(const auto& entry : cpu_bandwidth) {
+                out << "    cpu " << entry.first << ": " << entry.second << " bytes/second.\n";
+            }
+        }
+    }
+}
+
+static void report_end(std::ostream& out) {
+    if(options.format == "json") {
+        out << "\n]\n";
+    }
+}
+
+static uint64_t parse_size(const char* text);
+
+static std::vector<uint64_t> parse_size_list(const std::string& text) {
+    std::vector<uint64_t> list;
+    std::stringstream stream(text);
+    std::string item;
+
+    while(std::getline(stream, item, ',')) {
+        list.push_back(parse_size(item.c_str()));
+    }
+    return list;
+}
+
+static uint64_t parse_size(const char* text) {
+    char* suffix = nullptr;
+    uint64_t value = std::strtoull(text, &suffix, 0);
+
+    switch(*suffix) {
+        case 'G': case 'g':
+            return value << 30;
+        case 'M': case 'm':
+            return value << 20;
+        case 'K': case 'k':
+            return value << 10;
+        default:
+            return value;
+    }
+}
+
+static void usage(const char* name) {
+    std::cerr << "Usage: " << name << " [--size BYTES --count N] [--threads N] [--sweep [--min-size BYTES] [--max-size BYTES] [--step FACTOR] [--budget SECONDS]]\n";
+    std::cerr << "       [--kernel NAME[,NAME...]|all] [--alloc NAME[,NAME...]|all] [--pin compact|scatter|CPULIST]\n";
+    std::cerr << "       [--numa local|interleave|cross|NODE] [--stride line|page|BYTES] [--chains N] [--counters]\n";
+    std::cerr << "       [--warmup N] [--repeat N] [--format text|csv|json] [--output FILE]\n";
+    std::cerr << "       " << name << " --spsc [--pairs N] [--pair smt|core|socket] [--message BYTES] [--slots N] [--count N] [...]\n";
+    std::cerr << "       " << name << " --file PATH [--io METHOD[,METHOD...]|all] [--block BYTES] [--depth N] [--hot] [--size BYTES] [...]\n";
+    std::cerr << "       " << name << " --small [--sizes BYTES[,BYTES...]] [--misalign OFFSET[,OFFSET...]] [--kernel NAME[,NAME...]|all] [...]\n";
+    std::cerr << "Kernels:";
+    for(const kernel_struct& kernel : kernels) {
+        std::cerr << " " << kernel.name;
+    }
+    std::cerr << "\nFile methods:";
+    for(const kernel_struct& kernel : io_kernels) {
+        std::cerr << " " << kernel.name;
+    }
+    std::cerr << "\nAllocators:";
+    for(const allocator_struct& allocator : allocators) {
+        std::cerr << " " << allocator.name;
+    }
+    std::cerr << "\n";
+    exit(1);
+}
+
+/*  resolves the comma separated --kernel list, skipping the ones this CPU cannot run */
+static std::vector<const kernel_struct*> select_kernels(const char* name) {
+    std::vector<const kernel_struct*> selected;
+    std::string list = options.kernels + ",";
+    size_t start = 0;
+
+    for(size_t end = list.find(','); end != std::string::npos; start = end + 1, end = list.find(',', start)) {
+        std::string wanted = list.substr(start, end - start);
+        bool found = false;
+
+        for(const kernel_struct& kernel : kernels) {
+            if(wanted == "all" || wanted == kernel.name) {
+                found = true;
+                if(kernel.supported()) {
+                    selected.push_back(&kernel);
+                }
+                else if(wanted != "all") {
+                    std::cerr << "Kernel " << kernel.name << " is not supported on this CPU, skipping.\n";
+                }
+            }
+        }
+        if(!found) {
+            usage(name);
+        }
+    }
+    return selected;
+}
+
+static std::vector<const kernel_struct*> select_io(const char* name) {
+    std::vector<const kernel_struct*> selected;
+    std::string list = options.io + ",";
+    size_t start = 0;
+
+    for(size_t end = list.find(','); end != std::string::npos; start = end + 1, end = list.find(',', start)) {
+        std::string wanted = list.substr(start, end - start);
+        bool found = false;
+
+        for(const kernel_struct& kernel : io_kernels) {
+            if(wanted == "all" || wanted == kernel.name) {
+                found = true;
+                if(kernel.supported()) {
+                    selected.push_back(&kernel);
+                }
+                else {
+                    std::cerr << "Method " << kernel.name << " is not available for " << options.file << " here, skipping.\n";
+                }
+            }
+        }
+        if(!found) {
+            usage(name);
+        }
+    }
+    return selected;
+}
+
+static std::vector<const allocator_struct*> select_allocators(const char* name) {
+    std::vector<const allocator_struct*> selected;
+    std::string list = options.allocators + ",";
+    size_t start = 0;
+
+    for(size_t end = list.find(','); end != std::string::npos; start = end + 1, end = list.find(',', start)) {
+        std::string wanted = list.substr(start, end - start);
+        bool found = false;
+
+        for(const allocator_struct& allocator : allocators) {
+            if(wanted == "all" || wanted == allocator.name) {
+                found = true;
+                if(allocator_supported(&allocator)) {
+                    selected.push_back(&allocator);
+                }
+                else {
+                    std::cerr << "No " << allocator.name << " huge pages are reserved, skipping.\n";
+                }
+            }
+        }
+        if(!found) {
+            usage(name);
+        }
+    }
+    return selected;
+}
+
+/*  --pin takes compact, scatter or a list of CPUs and ranges, each CPU has to fit a cpu_set_t */
+static bool pin_valid(void) {
+    std::stringstream stream(options.pin);
+    std::string range;
+
+    if(options.pin.empty() || options.pin == "compact" || options.pin == "scatter") {
+        return true;
+    }
+    while(std::getline(stream, range, ',')) {
+        char* end = nullptr;
+        size_t dash = range.find('-');
+        if(range.empty() || !isdigit((unsigned char)range[0])) {
+            return false;
+        }
+        long first = strtol(range.c_str(), &end, 10);
+        long last = first;
+        if(dash != std::string::npos) {
+            if(end != range.c_str() + dash || !isdigit((unsigned char)range[dash + 1])) {
+                return false;
+            }
+            last = strtol(range.c_str() + dash + 1, &end, 10);
+        }
+        if(*end != '\0' || first > last || last >= CPU_SETSIZE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*  every copy has to fit the L1 sized buffers */
+static bool small_valid(void) {
+    std::vector<uint64_t> sizes = parse_size_list(options.sizes);
+    std::vector<uint64_t> offsets = parse_size_list(options.misalign);
+
+    return !sizes.empty() && !offsets.empty() && *std::max_element(sizes.begin(), sizes.end()) <= SMALL_MAX &&
+           *std::min_element(sizes.begin(), sizes.end()) > 0 && *std::max_element(offsets.begin(), offsets.end()) < 2 * CACHE_LINE;
+}
+
+int main(int argc, char** argv) {
+    for(int i = 1; i < argc; i++) {
+        bool has_value = (i + 1 < argc);
+
+        if(strcmp(argv[i], "--size") == 0 && has_value) {
+            options.size = parse_size(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--count") == 0 && has_value) {
+            options.count = std::strtoull(argv[++i], nullptr, 0);
+        }
+        else if(strcmp(argv[i], "--threads") == 0 && has_value) {
+            options.threads_count = std::strtoull(argv[++i], nullptr, 0);
+        }
+        else if(strcmp(argv[i], "--sweep") == 0) {
+            options.sweep = true;
+        }
+        else if(strcmp(argv[i], "--min-size") == 0 && has_value) {
+            options.min_size = parse_size(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--max-size") == 0 && has_value) {
+            options.max_size = parse_size(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--step") == 0 && has_value) {
+            options.step = std::strtod(argv[++i], nullptr);
+        }
+        else if(strcmp(argv[i], "--budget") == 0 && has_value) {
+            options.budget = std::strtod(argv[++i], nullptr);
+        }
+        else if(strcmp(argv[i], "--kernel") == 0 && has_value) {
+            options.kernels = argv[++i];
+        }
+        else if(strcmp(argv[i], "--alloc") == 0 && has_value) {
+            options.allocators = argv[++i];
+        }
+        else if(strcmp(argv[i], "--pin") == 0 && has_value) {
+            options.pin = argv[++i];
+        }
+        else if(strcmp(argv[i], "--numa") == 0 && has_value) {
+            std::string mode = argv[++i];
+            if(mode == "local") {
+                options.numa = NUMA_LOCAL;
+            }
+            else if(mode == "interleave") {
+                options.numa = NUMA_INTERLEAVE;
+            }
+            else if(mode == "cross") {
+                options.numa = NUMA_CROSS;
+            }
+            else if(!mode.empty() && mode.size() <= 4 && std::all_of(mode.begin(), mode.end(), [](char c) { return isdigit((unsigned char)c); }) &&
+                    std::stoi(mode) < NODEMASK_BITS) {
+                options.numa = NUMA_NODE;
+                options.numa_node = std::stoi(mode);
+            }
+            else {
+                usage(argv[0]);
+            }
+        }
+        else if(strcmp(argv[i], "--stride") == 0 && has_value) {
+            i++;
+            if(strcmp(argv[i], "line") == 0) {
+                options.stride = CACHE_LINE;
+            }
+            else if(strcmp(argv[i], "page") == 0) {
+                options.stride = sysconf(_SC_PAGESIZE);
+            }
+            else {
+                options.stride = parse_size(argv[i]);
+            }
+        }
+        else if(strcmp(argv[i], "--chains") == 0 && has_value) {
+            options.chains = std::strtoull(argv[++i], nullptr, 0);
+        }
+        else if(strcmp(argv[i], "--counters") == 0) {
+            options.counters = true;
+        }
+        else if(strcmp(argv[i], "--spsc") == 0) {
+            options.spsc = true;
+        }
+        else if(strcmp(argv[i], "--pairs") == 0 && has_value) {
+            options.pairs = std::strtoull(argv[++i], nullptr, 0);
+        }
+        else if(strcmp(argv[i], "--pair") == 0 && has_value) {
+            options.pair = argv[++i];
+            if(options.pair != "smt" && options.pair != "core" && options.pair != "socket") {
+                usage(argv[0]);
+            }
+        }
+        else if(strcmp(argv[i], "--message") == 0 && has_value) {
+            options.message = parse_size(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--slots") == 0 && has_value) {
+            options.slots = std::strtoull(argv[++i], nullptr, 0);
+        }
+        else if(strcmp(argv[i], "--file") == 0 && has_value) {
+            options.file = argv[++i];
+        }
+        else if(strcmp(argv[i], "--io") == 0 && has_value) {
+            options.io = argv[++i];
+        }
+        else if(strcmp(argv[i], "--block") == 0 && has_value) {
+            options.block = parse_size(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--depth") == 0 && has_value) {
+            options.depth = std::strtoull(argv[++i], nullptr, 0);
+        }
+        else if(strcmp(argv[i], "--hot") == 0) {
+            options.hot = true;
+        }
+        else if(strcmp(argv[i], "--small") == 0) {
+            options.small = true;
+        }
+        else if(strcmp(argv[i], "--sizes") == 0 && has_value) {
+            options.sizes = argv[++i];
+        }
+        else if(strcmp(argv[i], "--misalign") == 0 && has_value) {
+            options.misalign = argv[++i];
+        }
+        else if(strcmp(argv[i], "--warmup") == 0 && has_value) {
+            options.warmup = std::strtoull(argv[++i], nullptr, 0);
+        }
+        else if(strcmp(argv[i], "--repeat") == 0 && has_value) {
+            options.repeat = std::strtoull(argv[++i], nullptr, 0);
+        }
+        else if(strcmp(argv[i], "--format") == 0 && has_value) {
+            options.format = argv[++i];
+        }
+        else if(strcmp(argv[i], "--output") == 0 && has_value) {
+            options.output_path = argv[++i];
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+    if(options.step <= 1.0 || options.budget <= 0 || options.repeat == 0 || options.stride == 0 || options.stride % sizeof(uint8_t*) != 0 ||
+       options.chains == 0 || options.chains > CHASE_MAX_CHAINS || options.pairs == 0 || options.message < sizeof(uint64_t) ||
+       options.slots == 0 || (options.slots & (options.slots - 1)) != 0 || options.block == 0 || options.block % DIRECT_ALIGN != 0 ||
+       options.depth == 0 || !small_valid() || !pin_valid() || options.min_size == 0 || (options.format != "text" && options.format != "csv" && options.format != "json")) {
+        usage(argv[0]);
+    }
+
+    if(argc == 1) {
+        std::cout << "Memory area size (in bytes)? ";
+        std::cin >> options.size;
+        std::cout << "Number of transfers? ";
+        std::cin >> options.count;
+        std::cout << "Threads to be spawned? ";
+        std::cin >> options.threads_count;
+    }
+    if(options.spsc) {
+        options.threads_count = 2 * options.pairs;
+    }
+    if(options.threads_count == 0) {
+        options.threads_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    std::ofstream output_file;
+    if(options.output_path != nullptr) {
+        output_file.open(options.output_path);
+        if(!output_file) {
+            std::cerr << "Could not open " << options.output_path << " for writing.\n";
+            return 1;
+        }
+    }
+    std::ostream& out = (options.output_path != nullptr) ? output_file : std::cout;
+    std::vector<const kernel_struct*> selected = select_kernels(argv[0]);
+    std::vector<const allocator_struct*> selected_allocators = select_allocators(argv[0]);
+
+    topology_discover();
+    placement_compute();
+    if(options.counters) {
+        imc_open();
+    }
+    if(options.numa == NUMA_NODE && topology.node_cpus.count(options.numa_node) == 0) {
+        std::cerr << "Node " << options.numa_node << " has no CPUs available to us, binding to it anyway.\n";
+    }
+    if(options.numa == NUMA_CROSS && topology.node_cpus.size() < 2) {
+        std::cerr << "Only one NUMA node, --numa cross places source and destination on the same node.\n";
+    }
+    bool isgood = true;
+    bool first = true;
+
+    report_begin(out);
+    if(options.small) {
+        pin_thread(0);
+        for(const kernel_struct* kernel : selected) {
+            if(kernel->verify != VERIFY_COPY) {
+                std::cerr << "Kernel " << kernel->name << " is not a copy, skipping it for --small.\n";
+                continue;
+            }
+            std::vector<small_cell_struct> cells = run_small(kernel);
+            report_small(out, kernel->name, cells, first);
+            first = false;
+            for(const small_cell_struct& cell : cells) {
+                isgood = isgood && cell.verified;
+            }
+        }
+        std::vector<small_cell_struct> cells = run_small(nullptr);
+        report_small(out, "fixed", cells, first);
+        for(const small_cell_struct& cell : cells) {
+            isgood = isgood && cell.verified;
+        }
+    }
+    else if(!options.file.empty()) {
+        uint64_t file_size = io_prepare();
+        if(file_size == 0) {
+            return 1;
+        }
+        for(const kernel_struct* kernel : select_io(argv[0])) {
+            for(const allocator_struct* allocator : selected_allocators) {
+                std::vector<result_struct> results = run_io(kernel, allocator, file_size);
+                report_row(out, results, first);
+                first = false;
+                for(const result_struct& result : results) {
+                    isgood = isgood && result.verified;
+                }
+            }
+        }
+    }
+    else if(options.spsc) {
+        uint64_t count = (options.count != 0) ? options.count : SPSC_DEFAULT_COUNT;
+        for(const allocator_struct* allocator : selected_allocators) {
+            std::vector<pair_struct*> pairs = run_pairs(allocator, count);
+            if(options.format == "json" && !first) {
+                out << ",";
+            }
+            report_pairs(out, pairs, count);
+            first = false;
+            for(pair_struct* pair : pairs) {
+                isgood = isgood && pair->verified;
+                delete pair;
+            }
+        }
+    }
+    else if(options.sweep) {
+        /*  keep every thread's three buffers within three quarters of physical memory */
+        uint64_t memory_limit = (uint64_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE) / 4 * 3;
+        uint64_t size_limit = memory_limit / (3 * options.threads_count);
+
+        if(options.max_size > size_limit) {
+            std::cerr << "Capping sweep at " << size_limit << " bytes per buffer to fit in physical memory.\n";
+            options.max_size = size_limit;
+        }
+        for(double size = options.min_size; size <= options.max_size; size = size * options.step) {
+            for(const kernel_struct* kernel : selected) {
+                if(kernel->verify == VERIFY_CHASE && !chase_fits((uint64_t)size)) {
+                    continue;
+                }
+                /*  calibrated once so that every allocator does the same work */
+                uint64_t count = (options.count != 0) ? options.count : calibrate(kernel, selected_allocators.front(), (uint64_t)size);
+                for(const allocator_struct* allocator : selected_allocators) {
+                    std::vector<result_struct> results = run(kernel, allocator, (uint64_t)size, count);
+                    report_row(out, results, first);
+                    first = false;
+                    out.flush();
+                    for(const result_struct& result : results) {
+                        isgood = isgood && result.verified;
+                    }
+                }
+            }
+        }
+    }
+    else {
+        if(options.size == 0 || options.count == 0) {
+            usage(argv[0]);
+        }
+        for(const kernel_struct* kernel : selected) {
+            if(kernel->verify == VERIFY_CHASE && !chase_fits(options.size)) {
+                std::cerr << "Size " << options.size << " is too small for " << options.chains << " chains with a " << options.stride << " byte stride, skipping chase.\n";
+                continue;
+            }
+            for(const allocator_struct* allocator : selected_allocators) {
+                std::vector<result_struct> results = run(kernel, allocator, options.size, options.count);
+                report_row(out, results, first);
+                first = false;
+                for(const result_struct& result : results) {
+                    isgood = isgood && result.verified;
+                }
+            }
+        }
+    }
+    report_end(out);
+    if(verbose()) {
+        std::cout << "Complete!\n";
+    }
+    return isgood ? 0 : 1;
+}